@@ -0,0 +1,285 @@
+#include <new>
+#include "../yalo/yalo.h"
+
+/*
+    Measures what logging costs in an optimized build.
+    Every case is timed in batches of BatchCalls calls, each batch is one sample,
+    and the percentiles are of the per call time of those samples.
+    Allocations are counted by replacing the global operator new.
+    usage: bench_yalo [samples]
+*/
+
+// compiled with the trace macros, everything below the #undef is not
+static int tracedLoop(int calls) {
+    int taken = 0;
+
+    for (int call = 0; call < calls; ++call) {
+        if ((call & 3) == 0) {
+            ++taken;
+        }
+    }
+
+    return taken;
+}
+
+#undef if
+#undef while
+#undef switch
+
+static std::atomic<uint64_t>& allocations() {
+    static std::atomic<uint64_t> count(0);
+
+    return count;
+}
+
+// gcc cannot tell that these replace the global operators, so it sees malloc paired with delete
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    allocations().fetch_add(1, std::memory_order_relaxed);
+
+    void* memory = ::malloc(0 == size ? 1 : size);
+
+    if (nullptr == memory) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    ::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    ::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    ::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    ::free(memory);
+}
+
+static int plainLoop(int calls) {
+    int taken = 0;
+
+    for (int call = 0; call < calls; ++call) {
+        if ((call & 3) == 0) {
+            ++taken;
+        }
+    }
+
+    return taken;
+}
+
+class NullSink : public yalo::ISink {
+public:
+    virtual void log(const std::string& /*line*/) override {}
+    virtual ~NullSink()=default;
+};
+
+enum {BatchCalls = 64};
+
+struct Result {
+    Result():samples(), calls(0), allocations(0) {}
+
+    std::vector<double> samples; // nanoseconds per call
+    uint64_t calls;
+    uint64_t allocations;
+};
+
+static volatile int sink; // keeps the optimizer from removing loops
+
+/*
+    Runs body(BatchCalls) samples times, body does BatchCalls calls of the operation.
+*/
+template<typename Body>
+static Result measure(size_t samples, Body body) {
+    typedef std::chrono::steady_clock Clock;
+    Result result;
+
+    result.samples.reserve(samples);
+    body(BatchCalls); // warm up call sites, thread locals, and buffers
+
+    const auto before = allocations().load(std::memory_order_relaxed);
+
+    for (size_t sample = 0; sample < samples; ++sample) {
+        const auto start = Clock::now();
+
+        body(BatchCalls);
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+        result.samples.push_back(static_cast<double>(elapsed) / BatchCalls);
+    }
+
+    result.allocations = allocations().load(std::memory_order_relaxed) - before;
+    result.calls = static_cast<uint64_t>(samples) * BatchCalls;
+    return result;
+}
+
+static double percentile(std::vector<double>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+
+    const auto index = std::min(samples.size() - 1, static_cast<size_t>(fraction * static_cast<double>(samples.size())));
+
+    std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(index), samples.end());
+    return samples[index];
+}
+
+static void report(const char* name, Result result) {
+    const auto p50 = percentile(result.samples, 0.50);
+    const auto p99 = percentile(result.samples, 0.99);
+    const auto p999 = percentile(result.samples, 0.999);
+    const auto perCall = 0 == result.calls ? 0.0 : static_cast<double>(result.allocations) / static_cast<double>(result.calls);
+
+    printf("%-36s %10.1f %10.1f %10.1f %12.3f\n", name, p50, p99, p999, perCall);
+}
+
+static Result contention(size_t threads, size_t samples) {
+    std::vector<Result> results(threads);
+    std::vector<std::thread> running;
+    std::atomic<size_t> ready(0);
+    Result combined;
+
+    for (size_t index = 0; index < threads; ++index) {
+        running.push_back(std::thread([&results, &ready, index, threads, samples]() {
+            ++ready;
+
+            while (ready.load() < threads) {
+                std::this_thread::yield();
+            }
+
+            results[index] = measure(samples, [](int calls) {
+                for (int call = 0; call < calls; ++call) {
+                    lErr << "contended " << call;
+                }
+            });
+        }));
+    }
+
+    for (auto& thread : running) {
+        thread.join();
+    }
+
+    for (auto& result : results) {
+        combined.samples.insert(combined.samples.end(), result.samples.begin(), result.samples.end());
+        combined.calls += result.calls;
+        combined.allocations += result.allocations; // counted by every thread, so an upper bound
+    }
+
+    combined.allocations /= threads;
+    return combined;
+}
+
+int main(const int argc, const char* const argv[]) {
+    const size_t samples = argc > 1 ? static_cast<size_t>(std::atol(argv[1])) : 20000;
+    const char* const path = "bin/bench/bench_yalo.log";
+    char name[64];
+
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    printf("%-36s %10s %10s %10s %12s\n", "ns/call", "p50", "p99", "p99.9", "allocs/call");
+
+    yalo::Logger::resetLevels(yalo::Error);
+    report("disabled level", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            lDebug << "disabled " << call;
+        }
+    }));
+
+    report("enabled, null sink", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            lErr << "enabled " << call;
+        }
+    }));
+
+    yalo::Logger::setAsynchronous(1024);
+    report("enabled, null sink, asynchronous", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            lErr << "asynchronous " << call;
+        }
+    }));
+    yalo::Logger::setSynchronous();
+
+    {
+        yalo::DefaultFormatter formatter;
+        const yalo::Logger logger(yalo::Error, __FILE__, __LINE__, __func__, false);
+        const std::string line("a typical log line with a number 12345");
+        std::string buffer;
+
+        report("DefaultFormatter::format", measure(samples, [&formatter, &logger, &line](int calls) {
+            for (int call = 0; call < calls; ++call) {
+                sink = static_cast<int>(formatter.format(line, 1, logger).size());
+            }
+        }));
+
+        report("DefaultFormatter::formatInto", measure(samples, [&formatter, &logger, &line, &buffer](int calls) {
+            for (int call = 0; call < calls; ++call) {
+                buffer.clear();
+                formatter.formatInto(buffer, line.data(), line.size(), 1, logger);
+                sink = static_cast<int>(buffer.size());
+            }
+        }));
+    }
+
+    ::remove(path);
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<yalo::FileSink>(new yalo::FileSink(path)));
+    report("file sink", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            lErr << "file " << call;
+        }
+    }));
+
+    yalo::Logger::setAsynchronous(1024);
+    report("file sink, asynchronous", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            lErr << "file asynchronous " << call;
+        }
+    }));
+    yalo::Logger::setSynchronous();
+    ::remove(path);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    report("plain if", measure(samples, [](int calls) {sink = plainLoop(calls);}));
+    report("traced if, trace off", measure(samples, [](int calls) {sink = tracedLoop(calls);}));
+    yalo::Logger::setTraceMode(yalo::Logger::TraceCounters);
+    report("traced if, counters", measure(samples, [](int calls) {sink = tracedLoop(calls);}));
+    yalo::Logger::setTraceMode(yalo::Logger::TraceLines);
+
+    report("time scope", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            YALO_TIME_SCOPE(yalo::Error, "bench.scope");
+            sink = call;
+        }
+    }));
+    report("time scope, level off", measure(samples, [](int calls) {
+        for (int call = 0; call < calls; ++call) {
+            YALO_TIME_SCOPE(yalo::Debug, "bench.off");
+            sink = call;
+        }
+    }));
+
+    const auto cores = std::max<size_t>(2, std::thread::hardware_concurrency());
+
+    for (size_t threads = 1; threads <= cores; threads *= 2) {
+        snprintf(name, sizeof(name), "null sink, %d thread(s)", static_cast<int>(threads));
+        report(name, contention(threads, samples / threads));
+    }
+
+    return 0;
+}
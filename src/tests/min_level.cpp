@@ -0,0 +1,58 @@
+// Built with -DYALO_MIN_LEVEL=3, so Info and more detailed levels are compiled out.
+#include "../yalo/yalo.h"
+
+class DebugSink : public yalo::ISink {
+public:
+    std::string& logBuffer;
+
+    DebugSink(std::string& buffer):logBuffer(buffer) {}
+    virtual void log(const std::string& line) override {logBuffer += line;}
+    virtual ~DebugSink()=default;
+};
+
+static int countEvaluation(int& evaluations) {
+    evaluations += 1;
+    return evaluations;
+}
+
+static bool testCompiledOutOperands() {
+    int evaluations = 0;
+    int kept = 0;
+    std::string log;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Trace);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    lDebug << "debug" << countEvaluation(evaluations);
+    lInfo << "info" << countEvaluation(evaluations);
+    lInfoEvery(countEvaluation(evaluations)) << "info every" << countEvaluation(evaluations);
+    lInfoPerSecond(countEvaluation(evaluations)) << "info per second" << countEvaluation(evaluations);
+    lDebugEvery(countEvaluation(evaluations)) << "debug every" << countEvaluation(evaluations);
+    lVerboseEvery(countEvaluation(evaluations)) << "verbose every" << countEvaluation(evaluations);
+    lTracePerSecond(countEvaluation(evaluations)) << "trace per second" << countEvaluation(evaluations);
+    lTrace << "trace" << countEvaluation(evaluations);
+    lErrIf(false) << "error if" << countEvaluation(evaluations);
+    lErrIf(0 == countEvaluation(kept)) << "error if" << countEvaluation(kept);
+    lWarn << "warning " << countEvaluation(kept);
+
+    yalo::Logger::clearSinks();
+
+    const auto success = 0 == evaluations && 2 == kept && log.find("] warning 2\n") != std::string::npos
+                      && log.find("error if") == std::string::npos && YALO_MIN_LEVEL == 3;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testCompiledOutOperands() => evaluations = %d kept = %d\n", evaluations, kept);
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+int main(const int /*argc*/, const char* const /*argv*/[]) {
+    int failures = 0;
+
+    failures += testCompiledOutOperands() ? 0 : 1;
+    return failures;
+}
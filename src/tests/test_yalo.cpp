@@ -1,3 +1,5 @@
+#include <sys/stat.h>
+#include <clocale>
 #include "../yalo/yalo.h"
 
 class DebugSink : public yalo::ISink {
@@ -21,6 +23,101 @@ public:
     virtual ~ThrowingSink()=default;
 };
 
+class SlowSink : public yalo::ISink {
+public:
+    std::string& logBuffer;
+
+    SlowSink(std::string& buffer):logBuffer(buffer) {}
+    virtual void log(const std::string& line) override {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        logBuffer += line;
+    }
+    virtual ~SlowSink()=default;
+};
+
+class GateSink : public yalo::ISink {
+public:
+    const std::string gated;
+    std::atomic<int>& lines;
+    std::atomic<bool>& entered;
+    std::atomic<bool>& release;
+
+    GateSink(const char* text, std::atomic<int>& count, std::atomic<bool>& in, std::atomic<bool>& open)
+        :gated(text), lines(count), entered(in), release(open) {}
+    virtual void log(const std::string& line) override {
+        if (line.find(gated) != std::string::npos) {
+            entered = true;
+
+            while (!release) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        ++lines;
+    }
+    virtual ~GateSink()=default;
+};
+
+class WatchSink : public yalo::ISink {
+public:
+    std::string& logBuffer;
+    const std::string watched;
+    std::atomic<bool>& seen;
+
+    // seen is set after the line is appended, so once it is seen the buffer can be read
+    WatchSink(std::string& buffer, const char* text, std::atomic<bool>& flag)
+        :logBuffer(buffer), watched(text), seen(flag) {}
+    virtual void log(const std::string& line) override {
+        logBuffer += line;
+
+        if (line.find(watched) != std::string::npos) {
+            seen = true;
+        }
+    }
+    virtual ~WatchSink()=default;
+};
+
+class ReentrantSink : public yalo::ISink {
+public:
+    std::string& logBuffer;
+    std::string& addedBuffer;
+
+    ReentrantSink(std::string& buffer, std::string& added):logBuffer(buffer), addedBuffer(added) {}
+    virtual void log(const std::string& line) override {
+        logBuffer += line;
+
+        if (line.find("reenter") != std::string::npos) {
+            lErr << "nested";
+            yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(addedBuffer)));
+            lErr << "after add";
+        }
+    }
+    virtual ~ReentrantSink()=default;
+};
+
+class BracketFormatter : public yalo::IFormatter {
+public:
+    virtual std::string format(const std::string& line, size_t /*thread*/, const yalo::Logger& /*logger*/) override {
+        return "<" + line + ">\n";
+    }
+    virtual std::string format(const std::exception& exception) override {return exception.what();}
+    virtual ~BracketFormatter()=default;
+};
+
+class CountingFormatter : public BracketFormatter {
+public:
+    explicit CountingFormatter(std::atomic<int>& count):calls(count) {}
+    using BracketFormatter::format;
+    virtual std::string format(const std::string& line, size_t thread, const yalo::Logger& logger) override {
+        ++calls;
+        return BracketFormatter::format(line, thread, logger);
+    }
+    virtual ~CountingFormatter()=default;
+
+private:
+    std::atomic<int>& calls;
+};
+
 static bool testLevel(yalo::Level level) {
     yalo::Logger::clearSinks();
     yalo::Logger::resetLevels(level);
@@ -472,6 +569,14 @@ static bool createFile(const std::string& path, const std::string& contents) {
     return amount == contents.size();
 }
 
+static bool waitForSettingsLoad(uint64_t loadsBefore) {
+    for (int wait = 0; wait < 5000 && yalo::Logger::settingsLoads() == loadsBefore; ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return yalo::Logger::settingsLoads() != loadsBefore;
+}
+
 static bool testCommandFile() {
     const auto commands = R"(
         setFormatDefaultGMT
@@ -527,8 +632,11 @@ static bool testCommandFileCreated() {
     std::string log;
     yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
     yalo::Logger::setSettingsFile("bin/testCommandFileCreated.txt", 0);
+    const auto loads = yalo::Logger::settingsLoads();
     bool success = createFile("bin/testCommandFileCreated.txt", commands);
 
+    success = success && waitForSettingsLoad(loads);
+
     lDebug << "testing";
 
     yalo::Logger::setSettingsFile("bin/nonexistant/path/testCommandFileCreated.txt");
@@ -573,7 +681,9 @@ static bool testCommandFileUpdated() {
     yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
     bool success = createFile("bin/testCommandFileUpdated.txt", commands);
     yalo::Logger::setSettingsFile("bin/testCommandFileUpdated.txt", 0);
+    const auto loads = yalo::Logger::settingsLoads();
     success = success && createFile("bin/testCommandFileUpdated.txt", newCommands);
+    success = success && waitForSettingsLoad(loads);
 
     lDebug << "testing";
 
@@ -592,6 +702,40 @@ static bool testCommandFileUpdated() {
     return success;
 }
 
+static bool testCommandFilePolled() {
+    const auto commands = R"(
+        resetLevels: Log
+        setLevel:Debug=test_yalo.cpp
+    )";
+
+    ::remove("bin/testCommandFilePolled/settings.txt");
+    ::rmdir("bin/testCommandFilePolled");
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    yalo::Logger::setSettingsFile("bin/testCommandFilePolled/settings.txt", 0); // nothing to watch yet
+    const auto loads = yalo::Logger::settingsLoads();
+    bool success = ::mkdir("bin/testCommandFilePolled", 0755) == 0
+                && createFile("bin/testCommandFilePolled/settings.txt", commands)
+                && waitForSettingsLoad(loads);
+
+    lDebug << "testing";
+
+    yalo::Logger::setSettingsFile("");
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    success = success && log.find("testing") != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testCommandFilePolled()\n");
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
 static bool testConditionals() {
     const auto value1 = 5;
 
@@ -621,6 +765,1853 @@ static bool testConditionals() {
     return success;
 }
 
+static int countEvaluation(int& evaluations) {
+    evaluations += 1;
+    return evaluations;
+}
+
+static bool testDisabledNotEvaluated() {
+    int evaluations = 0;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Error);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    lDebug << "not shown" << countEvaluation(evaluations);
+    lWarnIf(true) << "not shown" << countEvaluation(evaluations);
+    lErrIf(false) << "not shown" << countEvaluation(evaluations);
+    lErr << "shown" << countEvaluation(evaluations);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = evaluations == 1
+                      && log.find("not shown") == std::string::npos
+                      && log.find("shown") != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testDisabledNotEvaluated() => evaluations = %d\n", evaluations);
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static bool testTraceCounters() {
+    int ignored = 0;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Trace);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    yalo::Logger::setTraceMode(yalo::Logger::TraceCounters);
+
+    for (int i = 0; i < 10; ++i) {
+        if (i % 3 == 0) {
+            ignored += 1;
+        }
+    }
+
+    const auto countedLog = log;
+
+    yalo::Logger::setTraceMode(yalo::Logger::TraceCounters, 5);
+
+    for (int i = 0; i < 10; ++i) {
+        if (i % 2 == 0) {
+            ignored += 1;
+        }
+    }
+
+    const auto sampledLog = log;
+    uint64_t taken = 0;
+    uint64_t notTaken = 0;
+
+    for (const auto& count : yalo::Logger::traceCounts()) {
+        if (::strcmp(count.expression, "i % 3 == 0") == 0) {
+            taken = count.taken;
+            notTaken = count.notTaken;
+        }
+    }
+
+    log.clear();
+    yalo::Logger::logTraceCounts();
+    yalo::Logger::setTraceMode(yalo::Logger::TraceLines);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto firstSample = sampledLog.find("i % 2 == 0 => ");
+    const auto success = countedLog.empty() && 4 == taken && 6 == notTaken && 9 == ignored
+                      && firstSample != std::string::npos
+                      && sampledLog.find("i % 2 == 0 => ", firstSample + 1) != std::string::npos
+                      && sampledLog.find("i % 2 == 0 => ", sampledLog.find("i % 2 == 0 => ", firstSample + 1) + 1)
+                            == std::string::npos
+                      && log.find("if: i % 3 == 0 true 4 false 6") != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testTraceCounters() %d %d\n", static_cast<int>(taken), static_cast<int>(notTaken));
+        fprintf(stderr, "[%s][%s][%s]\n", countedLog.c_str(), sampledLog.c_str(), log.c_str());
+    }
+
+    return success;
+}
+
+static size_t countOf(const std::string& text, const std::string& part) {
+    size_t count = 0;
+
+    for (auto found = text.find(part); found != std::string::npos; found = text.find(part, found + 1)) {
+        count += 1;
+    }
+
+    return count;
+}
+
+static bool testRateLimited() {
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterPad);
+    yalo::Logger::resetLevels(yalo::Error);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    for (int i = 0; i < 10; ++i) {
+        lErrEvery(3) << "every" << i;
+    }
+
+    const auto everyLog = log;
+
+    log.clear();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+
+    for (int i = 0; i < 4; ++i) {
+        lErrEvery(2) << "as is " << i;
+    }
+
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterPad);
+
+    const auto asIsLog = log;
+
+    log.clear();
+
+    for (int i = 0; i < 10; ++i) {
+        lWarnPerSecond(100) << "hidden";
+        lErrPerSecond(2) << "per second";
+    }
+
+    yalo::Logger::setSuppressedSummary(false);
+    lErrEvery(0) << "never";
+    yalo::Logger::setSuppressedSummary(true);
+
+    const auto perSecondLog = log;
+
+    log.clear();
+    yalo::Logger::resetLevels(yalo::Trace);
+
+    for (int i = 0; i < 4; ++i) {
+        lVerboseEvery(2) << "verbose every";
+        lTracePerSecond(1) << "trace per second";
+    }
+
+    yalo::Logger::resetLevels(yalo::Error);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = countOf(everyLog, "] every") == 1
+                      && countOf(everyLog, "] (suppressed 2 repeats) every") == 3
+                      && everyLog.find("every 9\n") != std::string::npos
+                      && asIsLog.find("] as is 0\n") != std::string::npos
+                      && asIsLog.find("] (suppressed 1 repeats) as is 2\n") != std::string::npos
+                      && countOf(perSecondLog, "per second") == 2
+                      && perSecondLog.find("hidden") == std::string::npos
+                      && perSecondLog.find("never") == std::string::npos
+                      && countOf(log, "verbose every") == 2 && countOf(log, "trace per second") == 1;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testRateLimited()\n");
+        fprintf(stderr, "[%s][%s][%s][%s]\n", everyLog.c_str(), asIsLog.c_str(), perSecondLog.c_str(), log.c_str());
+    }
+
+    return success;
+}
+
+static bool testSinkBatch() {
+    const char* const path = "bin/testSinkBatch.log";
+    const yalo::Record records[] = {
+        yalo::Record(yalo::Log, "second\n"), yalo::Record(yalo::Log, ""), yalo::Record(yalo::Log, "third\n"),
+    };
+    std::vector<yalo::Record> many;
+    std::string expected = "first\nsecond\nthird\nalone\n";
+    std::string defaultBatch;
+
+    for (int index = 0; index < 100; ++index) {
+        many.push_back(yalo::Record(yalo::Log, "line " + std::to_string(index) + "\n"));
+        expected += many.back().line;
+    }
+
+    ::remove(path);
+
+    {
+        yalo::FileSink sink(path);
+
+        sink.log("first\n");
+        sink.logBatch(records, 3);
+        sink.logBatch(records + 2, 0);
+        sink.log("alone\n");
+        sink.logBatch(many.data(), many.size());
+    }
+
+    DebugSink debug(defaultBatch);
+
+    debug.logBatch(records, 3);
+
+    const auto contents = readFileContents(path);
+    const auto success = contents == expected && defaultBatch == "second\nthird\n";
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testSinkBatch()\n");
+        fprintf(stderr, "[%s][%s]\n", contents.c_str(), defaultBatch.c_str());
+    }
+
+    return success;
+}
+
+static bool testBufferedFileSink() {
+    const char* const path = "bin/testBufferedFileSink.log";
+    const char* const syncedPath = "bin/testBufferedFileSinkSynced.log";
+    const yalo::Record info[] = {yalo::Record(yalo::Info, "one\n"), yalo::Record(yalo::Debug, "two\n")};
+    const yalo::Record error(yalo::Error, "three\n");
+    yalo::BufferedFileSink::Policy policy;
+    yalo::BufferedFileSink::Policy syncEveryWrite;
+    std::string buffered;
+    std::string urgent;
+    std::string flushed;
+    std::string timed;
+
+    policy.bufferBytes = 1024 * 1024;
+    policy.flushMilliseconds = 60000;
+    syncEveryWrite.bufferBytes = 1;
+    syncEveryWrite.syncSeconds = 0;
+    ::remove(path);
+    ::remove(syncedPath);
+
+    {
+        yalo::BufferedFileSink sink(path, policy);
+        yalo::BufferedFileSink synced(syncedPath, syncEveryWrite);
+
+        sink.logBatch(info, 2);
+        buffered = readFileContents(path);
+        sink.logBatch(&error, 1);
+        urgent = readFileContents(path);
+        sink.log("four\n");
+        sink.sync();
+        flushed = readFileContents(path);
+        synced.log("synced\n");
+        sink.log("five\n");
+    }
+
+    policy.flushMilliseconds = 20;
+
+    {
+        yalo::BufferedFileSink sink(path, policy);
+
+        sink.log("six\n");
+        buffered += readFileContents(path) == flushed + "five\n" ? "" : "six too soon";
+
+        for (int attempt = 0; attempt < 5000 && timed != flushed + "five\nsix\n"; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            sink.logBatch(nullptr, 0); // writes once the line has been buffered for 20 milliseconds
+            timed = readFileContents(path);
+        }
+    }
+
+    const auto success = buffered.empty() && urgent == "one\ntwo\nthree\n" && flushed == urgent + "four\n"
+                      && readFileContents(syncedPath) == "synced\n"
+                      && timed == flushed + "five\nsix\n";
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testBufferedFileSink()\n");
+        fprintf(stderr, "[%s][%s][%s][%s]\n", buffered.c_str(), urgent.c_str(), flushed.c_str(), timed.c_str());
+    }
+
+    return success;
+}
+
+static bool testMappedFileSink() {
+    const std::string path = "bin/testMappedFileSink.log";
+    std::string expected;
+    std::string whileOpen;
+    std::string lastSegment;
+    std::string segments;
+    bool badSegment = false;
+
+    for (int index = 0; index < 10; ++index) {
+        ::remove((path + ".00000" + std::to_string(index)).c_str());
+    }
+
+    {
+        yalo::MappedFileSink sink(path, yalo::MappedFileSink::HeaderSize + 32);
+
+        for (int index = 0; index < 10; ++index) {
+            const auto line = "line " + std::to_string(index) + "\n";
+
+            sink.log(line);
+            expected += line;
+        }
+
+        sink.log(std::string(100, 'x') + "\n");
+        expected += std::string(100, 'x') + "\n";
+        sink.log("last\n");
+        expected += "last\n";
+        sink.sync();
+        whileOpen = yalo::MappedFileSink::read(sink.segmentPath());
+        lastSegment = sink.segmentPath();
+    }
+
+    for (int index = 0; index < 10; ++index) {
+        const auto segment = path + ".00000" + std::to_string(index);
+
+        if (readFileContents(segment).size() > 0) {
+            segments += yalo::MappedFileSink::read(segment);
+        }
+    }
+
+    try {
+        yalo::MappedFileSink::read("bin/testLogFile.txt");
+        badSegment = true;
+    } catch(const std::exception&) {
+        // expected
+    }
+
+    const auto success = segments == expected && whileOpen == "last\n"
+                      && lastSegment == path + ".000004" && !badSegment;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testMappedFileSink()\n");
+        fprintf(stderr, "[%s][%s][%s]\n", segments.c_str(), whileOpen.c_str(), lastSegment.c_str());
+    }
+
+    return success;
+}
+
+static bool testRotatingFileSink() {
+    const std::string path = "bin/testRotatingFileSink.log";
+    const char* const extensions[] = {"", ".gz"};
+    const char* const badValues[] = {"generations=5K", "maxBytes=abc", "maxBytes=10x", "maxBytes=-1", "maxBytes=",
+                                     "maxBytes=99999999999999999999", "maxBytes=99999999999G", "intervalSeconds=-5",
+                                     "intervalSeconds=1h", "intervalSeconds=99999999999", "compression=gz", "compression"};
+    const std::string settings = "bin/testRotatingFileSink.txt";
+    const std::string configuredPath = "bin/testRotatingFileSinkSettings.log";
+    yalo::RotatingFileSink::Policy policy;
+    std::string log;
+    bool badOption = false;
+    int badValuesRejected = 0;
+
+    ::remove(configuredPath.c_str());
+
+    for (int index = 0; index < 4; ++index) {
+        for (const auto extension : extensions) {
+            ::remove((path + (index == 0 ? "" : "." + std::to_string(index)) + extension).c_str());
+        }
+    }
+
+    policy.maxBytes = 10;
+    policy.generations = 2;
+    policy.compression = yalo::RotatingFileSink::Gzip;
+
+    {
+        yalo::RotatingFileSink sink(path, policy);
+
+        sink.log("aaaaaaaaaa\n");
+        sink.log("bbbbbbbbbb\n");
+        sink.log("cccccccccc\n");
+        sink.log("dddddddddd\n");
+        sink.waitForRotations();
+    }
+
+    const auto parsed = yalo::RotatingFileSink::policy("maxBytes=2K generations=3 intervalSeconds=60 compression=zstd");
+
+    try {
+        yalo::RotatingFileSink::policy("sizes=3");
+    } catch(const std::invalid_argument&) {
+        badOption = true;
+    }
+
+    for (const auto value : badValues) {
+        try {
+            yalo::RotatingFileSink::policy(value);
+        } catch(const std::invalid_argument&) {
+            ++badValuesRejected;
+        }
+    }
+
+    const auto created = createFile(settings, "addRotatingSink: " + configuredPath + " maxBytes=1K generations=1\n"
+                                              "addRotatingSink: bin/testRotatingFileSinkBad.log maxBytes=10x\n");
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Log);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    yalo::Logger::setSettingsFile(settings);
+    lLog << "rotating from settings";
+    yalo::Logger::setSettingsFile("bin/nonexistant/path/testRotatingFileSink.txt");
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto newest = readFileContents(path + ".1.gz");
+    const auto success = readFileContents(path) == "dddddddddd\n"
+                      && newest.size() > 2 && newest[0] == '\x1f' && newest[1] == '\x8b'
+                      && !readFileContents(path + ".2.gz").empty()
+                      && readFileContents(path + ".3.gz").empty()
+                      && readFileContents(path + ".1").empty()
+                      && parsed.maxBytes == 2048 && parsed.generations == 3 && parsed.intervalSeconds == 60
+                      && parsed.compression == yalo::RotatingFileSink::Zstd && badOption
+                      && sizeof(badValues) / sizeof(badValues[0]) == static_cast<size_t>(badValuesRejected)
+                      && created && readFileContents(configuredPath).find("rotating from settings\n") != std::string::npos
+                      && log.find("Error adding rotating sink to bin/testRotatingFileSinkBad.log maxBytes=10x: "
+                                  "Rotation option is not a number: maxBytes=10x") != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testRotatingFileSink() => rejected %d\n", badValuesRejected);
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static int bindDatagramSocket(const std::string& path) {
+    struct sockaddr_un address;
+    const auto bound = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    ::remove(path.c_str());
+    ::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    ::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    if (bound < 0 || ::bind(bound, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
+        return -1;
+    }
+
+    ::fcntl(bound, F_SETFL, ::fcntl(bound, F_GETFL) | O_NONBLOCK);
+    return bound;
+}
+
+static std::string receiveDatagram(int socket) {
+    char buffer[4096];
+    const auto received = ::recv(socket, buffer, sizeof(buffer), 0);
+
+    return received < 0 ? std::string() : std::string(buffer, static_cast<size_t>(received));
+}
+
+static bool testSyslogSocketSink() {
+    const std::string path = "bin/testSyslogSocketSink.sock";
+    const auto daemon = bindDatagramSocket(path);
+    const yalo::Record records[] = {yalo::Record(yalo::Error, "first\n"), yalo::Record(yalo::Debug, "second\n")};
+    const yalo::Record multiLine(yalo::Warning, "one\ntwo\n");
+    yalo::SyslogSocketSink::Policy policy;
+    yalo::SyslogSocketSink::Policy journald;
+    std::string error;
+    std::string debug;
+    std::string journal;
+    size_t pendingWhenFull = 0;
+    size_t dropped = 0;
+    size_t pendingAfterDrain = 1;
+
+    policy.path = path;
+    policy.identity = "test";
+    policy.pendingLines = 4;
+    journald.path = path;
+    journald.protocol = yalo::SyslogSocketSink::Journald;
+    journald.identity = "test";
+
+    {
+        yalo::SyslogSocketSink sink(policy);
+        yalo::SyslogSocketSink journalSink(journald);
+
+        sink.logBatch(records, 2);
+        error = receiveDatagram(daemon);
+        debug = receiveDatagram(daemon);
+
+        journalSink.logBatch(&multiLine, 1);
+        journal = receiveDatagram(daemon);
+
+        // nobody is reading, so the socket fills, then the queue, then lines are dropped
+        for (int line = 0; line < 10000 && sink.dropped() == 0; ++line) {
+            sink.log("filler\n");
+        }
+
+        pendingWhenFull = sink.pending();
+        dropped = sink.dropped();
+
+        while (!receiveDatagram(daemon).empty()) {}
+
+        sink.logBatch(nullptr, 0);
+        pendingAfterDrain = sink.pending();
+    }
+
+    ::close(daemon);
+    ::remove(path.c_str());
+
+    const std::string length("\x07\0\0\0\0\0\0\0", 8);
+    const auto success = error.find("<11>1 ") == 0 && error.find(" test ") != std::string::npos
+                      && error.size() > 10 && error.compare(error.size() - 10, 10, " - - first") == 0
+                      && debug.find("<15>1 ") == 0
+                      && journal.find("PRIORITY=4\n") == 0
+                      && journal.find("\nSYSLOG_IDENTIFIER=test\n") != std::string::npos
+                      && journal.find("\nMESSAGE\n" + length + "one\ntwo\n") != std::string::npos
+                      && pendingWhenFull == 4 && dropped > 0 && pendingAfterDrain == 0;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testSyslogSocketSink() => pending %d dropped %d after %d\n[%s]\n[%s]\n",
+                static_cast<int>(pendingWhenFull), static_cast<int>(dropped), static_cast<int>(pendingAfterDrain),
+                error.c_str(), journal.c_str());
+    }
+
+    return success;
+}
+
+static int listenOnLoopback(int type, int& port) {
+    struct sockaddr_in address;
+    socklen_t size = sizeof(address);
+    const auto listening = ::socket(AF_INET, type, 0);
+
+    ::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (listening < 0 || ::bind(listening, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0
+            || (SOCK_STREAM == type && ::listen(listening, 4) != 0)
+            || ::getsockname(listening, reinterpret_cast<struct sockaddr*>(&address), &size) != 0) {
+        return -1;
+    }
+
+    port = ntohs(address.sin_port);
+    return listening;
+}
+
+static bool waitReadable(int socket, int milliseconds) {
+    struct pollfd descriptor;
+
+    descriptor.fd = socket;
+    descriptor.events = POLLIN;
+    descriptor.revents = 0;
+    return ::poll(&descriptor, 1, milliseconds) > 0;
+}
+
+static std::string receiveUntil(int socket, const std::string& expected) {
+    std::string received;
+    char buffer[1024];
+
+    while (received.find(expected) == std::string::npos && waitReadable(socket, 5000)) {
+        const auto size = ::recv(socket, buffer, sizeof(buffer), 0);
+
+        if (size <= 0) {
+            break;
+        }
+
+        received.append(buffer, static_cast<size_t>(size));
+    }
+
+    return received;
+}
+
+static bool testNetworkSink() {
+    int tcpPort = 0;
+    int udpPort = 0;
+    int closedPort = 0;
+    const auto listening = listenOnLoopback(SOCK_STREAM, tcpPort);
+    const auto datagrams = listenOnLoopback(SOCK_DGRAM, udpPort);
+    const yalo::Record records[] = {yalo::Record(yalo::Info, "udp one\n"), yalo::Record(yalo::Info, "udp two\n")};
+    yalo::NetworkSink::Policy tiny;
+    std::string first;
+    std::string second;
+    std::string udp;
+    std::string configured;
+    bool sent = false;
+    size_t connects = 0;
+    size_t dropped = 0;
+    size_t spooled = 0;
+    int badUrls = 0;
+
+    ::close(listenOnLoopback(SOCK_STREAM, closedPort)); // nothing listens there now
+
+    {
+        yalo::NetworkSink sink("tcp://127.0.0.1:" + std::to_string(tcpPort));
+
+        sink.log("one\n");
+        sink.log("two\n");
+
+        auto connection = waitReadable(listening, 5000) ? ::accept(listening, nullptr, nullptr) : -1;
+
+        first = receiveUntil(connection, "two\n");
+        sent = sink.waitUntilSent(5000);
+        ::close(connection);
+
+        // keep logging until the sink notices and connects again
+        connection = -1;
+
+        for (int attempt = 0; attempt < 500 && connection < 0; ++attempt) {
+            sink.log("again\n");
+
+            if (waitReadable(listening, 10)) {
+                connection = ::accept(listening, nullptr, nullptr);
+            }
+        }
+
+        second = receiveUntil(connection, "again\n");
+        connects = sink.connects();
+        ::close(connection);
+    }
+
+    {
+        const auto settings = "bin/testNetworkSink.txt";
+        const auto created = createFile(settings, "addSink: tcp://127.0.0.1:" + std::to_string(tcpPort) + "\n");
+
+        yalo::Logger::clearSinks();
+        yalo::Logger::resetLevels(yalo::Log);
+        yalo::Logger::setSettingsFile(settings);
+        lLog << "from settings";
+
+        const auto connection = created && waitReadable(listening, 5000) ? ::accept(listening, nullptr, nullptr) : -1;
+
+        configured = receiveUntil(connection, "from settings\n");
+        yalo::Logger::setSettingsFile("bin/nonexistant/path/testNetworkSink.txt");
+        yalo::Logger::clearSinks(); // the sink finishes sending before it is destroyed
+        yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+        ::close(connection);
+    }
+
+    {
+        yalo::NetworkSink sink("udp://127.0.0.1:" + std::to_string(udpPort));
+
+        sink.logBatch(records, 2);
+        udp = receiveUntil(datagrams, "udp two\n");
+    }
+
+    tiny.spoolBytes = 20;
+    tiny.lingerMilliseconds = 0;
+
+    {
+        yalo::NetworkSink sink("tcp://127.0.0.1:" + std::to_string(closedPort), tiny);
+
+        for (int line = 0; line < 10; ++line) {
+            sink.log("0123456789\n");
+        }
+
+        dropped = sink.dropped();
+        spooled = sink.spooled();
+    }
+
+    for (const auto url : {"http://127.0.0.1:80", "tcp://127.0.0.1", "tcp://127.0.0.1:"}) {
+        try {
+            yalo::NetworkSink sink(url);
+        } catch(const std::invalid_argument&) {
+            ++badUrls;
+        }
+    }
+
+    ::close(listening);
+    ::close(datagrams);
+
+    const auto success = first == "one\ntwo\n" && sent && second.find("again\n") != std::string::npos
+                      && connects >= 2 && udp == "udp one\nudp two\n"
+                      && configured.find("Adding sink to tcp://127.0.0.1:") != std::string::npos
+                      && configured.find("from settings\n") != std::string::npos
+                      && dropped == 9 && spooled == 11 && badUrls == 3;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testNetworkSink() => connects %d dropped %d spooled %d bad %d\n[%s][%s][%s]\n",
+                static_cast<int>(connects), static_cast<int>(dropped), static_cast<int>(spooled), badUrls,
+                first.c_str(), second.c_str(), udp.c_str());
+        fprintf(stderr, "[%s]\n", configured.c_str());
+    }
+
+    return success;
+}
+
+static bool testCompiledOut() {
+    int evaluations = 0;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Trace);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    YALO_LOG_OFF << "compiled out" << countEvaluation(evaluations);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = evaluations == 0 && log.empty() && YALO_MIN_LEVEL == 7;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testCompiledOut() => evaluations = %d\n", evaluations);
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static void logFromOneCallSite(const std::string& message) {
+    lDebug << message;
+}
+
+static bool testCallSiteCache() {
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Error);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    logFromOneCallSite("--first--");
+    yalo::Logger::resetLevels(yalo::Debug);
+    logFromOneCallSite("--second--");
+    yalo::Logger::resetLevels(yalo::Info);
+    logFromOneCallSite("--third--");
+    yalo::Logger::setLevel(yalo::Debug, "test_yalo.cpp");
+    logFromOneCallSite("--fourth--");
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = log.find("--first--") == std::string::npos
+                      && log.find("--second--") != std::string::npos
+                      && log.find("--third--") == std::string::npos
+                      && log.find("--fourth--") != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testCallSiteCache()\n");
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static void thread_shown(const std::atomic<bool>* running, int* shownCount) {
+    while (running->load()) {
+        *shownCount += yalo::Logger::shown(yalo::Debug, __FILE__) ? 1 : 0;
+    }
+}
+
+static bool testLevelsWhileReading() {
+    std::atomic<bool> running(true);
+    int shownCounts[4] = {0, 0, 0, 0};
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    std::thread t1(thread_shown, &running, &shownCounts[0]);
+    std::thread t2(thread_shown, &running, &shownCounts[1]);
+    std::thread t3(thread_shown, &running, &shownCounts[2]);
+    std::thread t4(thread_shown, &running, &shownCounts[3]);
+
+    for (int i = 0; i < 200; ++i) {
+        yalo::Logger::resetLevels(i % 2 == 0 ? yalo::Debug : yalo::Error);
+        yalo::Logger::setLevel(yalo::Verbose, "test_yalo.cpp");
+    }
+
+    running.store(false);
+    t1.join();
+    t2.join();
+    t3.join();
+    t4.join();
+
+    yalo::Logger::resetLevels(yalo::Error);
+    const auto success = !yalo::Logger::shown(yalo::Debug, __FILE__)
+                      && yalo::Logger::shown(yalo::Error, __FILE__);
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testLevelsWhileReading()\n");
+    }
+
+    return success;
+}
+
+static bool referenceFileMatches(const std::string& file, const std::string& pattern) {
+    size_t start = 0;
+    auto good = true;
+
+    while (start < pattern.size()) {
+        const auto end = pattern.find(';', start);
+        const auto part = pattern.substr(start, end-start);
+        const auto negative = part.find('-') == 0;
+        const auto name = part.substr(negative ? 1 : 0);
+
+        if (file.find(name) != std::string::npos) {
+            good = !negative;
+        }
+
+        start = end < pattern.size() ? end + 1 : end;
+    }
+
+    return good;
+}
+
+static bool testFilePatternMatcher() {
+    const char* const patterns[] = {
+        "", "-", "src/", "-bin/", "src/;-src/include/", "src/;-src/include/;.cpp",
+        ".h;.cpp;-main.cpp;-test.cpp", ";-src/", "-;src/", "src/net/;src/db/;-src/db/test/",
+        "a;b;c;d;e;-ab;-bc", "src/net/;src/db/;-src/db/test/;.h;-main;tests/;-yalo;ya",
+        "aaa;-aa;a;-aaaa;ba;-cab;abc"
+    };
+    const char* const files[] = {
+        "", "main.cpp", "src/main.cpp", "src/include/a.h", "src/include/a.cpp", "bin/x.o",
+        "src/db/test/t.cpp", "src/db/a.cpp", "src/net/socket.h", "src/tests/test_yalo.cpp",
+        "abcde", "aaaa", "cabc", "xbay"
+    };
+    bool success = true;
+
+    for (const auto pattern : patterns) {
+        const yalo::FilePattern matcher(pattern);
+
+        for (const auto file : files) {
+            if (matcher.matches(file) != referenceFileMatches(file, pattern)) {
+                fprintf(stderr, "FAIL: testFilePatternMatcher() pattern='%s' file='%s'\n", pattern, file);
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+static bool waitFor(const std::atomic<bool>& flag) {
+    for (int attempt = 0; attempt < 5000 && !flag; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return flag;
+}
+
+static bool testSinksInParallel() {
+    std::atomic<int> first(0);
+    std::atomic<int> second(0);
+    std::atomic<bool> firstEntered(false);
+    std::atomic<bool> secondEntered(false);
+    std::atomic<bool> never(false);
+    std::atomic<bool> release(false);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Log);
+    yalo::Logger::addSink(std::unique_ptr<GateSink>(new GateSink("never", first, firstEntered, never)));
+    yalo::Logger::addSink(std::unique_ptr<GateSink>(new GateSink("slow", second, secondEntered, release)));
+
+    // the first thread is stuck in the second sink while the other writes to the first
+    std::thread slow([]() {lLog << "slow";});
+    const auto blocked = waitFor(secondEntered);
+    std::thread other([]() {lLog << "other";});
+
+    for (int attempt = 0; attempt < 5000 && first != 2; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const auto parallel = first == 2 && second == 0;
+
+    release = true;
+    slow.join();
+    other.join();
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = blocked && parallel && second == 2 && !firstEntered;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testSinksInParallel() => first = %d second = %d\n",
+                first.load(), second.load());
+    }
+
+    return success;
+}
+
+static bool testAsynchronous() {
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    yalo::Logger::setAsynchronous(16);
+
+    std::thread t1(thread_logging, 1);
+    std::thread t2(thread_logging, 2);
+    std::thread t3(thread_logging, 3);
+
+    t1.join();
+    t2.join();
+    t3.join();
+
+    yalo::Logger::flush();
+    const auto lines = std::count(log.begin(), log.end(), '\n');
+
+    yalo::Logger::clearSinks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(250)); // the idle writer ticks every 100 milliseconds
+
+    const auto idleSinks = yalo::Logger::stats().sinks.size();
+
+    yalo::Logger::setSynchronous();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = lines == 300 && 0 == idleSinks;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testAsynchronous() => lines = %d sinks = %d\n", static_cast<int>(lines),
+                static_cast<int>(idleSinks));
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static bool testAsynchronousThreadExit() {
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    yalo::Logger::setAsynchronous(8);
+
+    for (int identifier = 0; identifier < 20; ++identifier) {
+        std::thread shortLived(thread_logging, identifier);
+
+        shortLived.join();
+    }
+
+    yalo::Logger::flush();
+    yalo::Logger::setSynchronous();
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto lines = std::count(log.begin(), log.end(), '\n');
+    const auto first = log.find("thread #7 iteration #0\n");
+    const auto last = log.find("thread #7 iteration #99\n");
+    const auto success = lines == 2000 && first != std::string::npos
+                      && last != std::string::npos && first < last;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testAsynchronousThreadExit() => lines = %d\n", static_cast<int>(lines));
+    }
+
+    return success;
+}
+
+static std::atomic<int>& statsReports() {
+    static std::atomic<int> reports(0);
+
+    return reports;
+}
+
+static void countStatsReport(const yalo::Stats& stats) {
+    if (stats.requested > 0) {
+        ++statsReports();
+    }
+}
+
+static bool testReentrantSink() {
+    std::string log;
+    std::string added;
+    std::atomic<bool> done(false);
+    std::atomic<int> gated(0);
+    std::atomic<bool> entered(false);
+    std::atomic<bool> release(false);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Error);
+    yalo::Logger::addSink(std::unique_ptr<ReentrantSink>(new ReentrantSink(log, added)));
+
+    std::thread reentering([&done]() {
+        lErr << "reenter";
+        done = true;
+    });
+
+    const auto returned = waitFor(done);
+
+    returned ? reentering.join() : reentering.detach();
+
+    // publishing must not wait for a thread that is inside a slow sink
+    std::atomic<bool> published(false);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<GateSink>(new GateSink("slow", gated, entered, release)));
+
+    std::thread slow([]() {lErr << "slow";});
+
+    waitFor(entered);
+
+    std::thread publishing([&published]() {
+        yalo::Logger::clearSinks();
+        yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+        published = true;
+    });
+
+    const auto notBlocked = waitFor(published);
+
+    release = true;
+    slow.join();
+    publishing.join();
+
+    const auto success = returned && notBlocked && log.find("] reenter\n") != std::string::npos
+                      && log.find("nested") == std::string::npos && added.find("] after add\n") != std::string::npos
+                      && 1 == gated.load();
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testReentrantSink() => returned %d published %d\n", returned ? 1 : 0, notBlocked ? 1 : 0);
+        fprintf(stderr, "[%s][%s]\n", log.c_str(), added.c_str());
+    }
+
+    return success;
+}
+
+static bool testSinkLevels() {
+    std::string console;
+    std::string verbose;
+    std::string copy;
+    std::atomic<int> calls(0);
+    const yalo::Logger::SharedFormatter brackets(new CountingFormatter(calls));
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Trace);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(console)), yalo::Warning);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(verbose)), yalo::Debug, brackets);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(copy)), yalo::Debug, brackets);
+
+    const auto before = yalo::Logger::stats();
+
+    lErr << "both";
+    lDebug << "verbose";
+    lTrace << "nobody";
+
+    const auto after = yalo::Logger::stats();
+    const auto synchronousCalls = calls.load();
+
+    yalo::Logger::setAsynchronous(16);
+    lWarn << "queued";
+    lInfo << "queued verbose";
+    yalo::Logger::flush();
+
+    // a sink with its own formatter, added while lines are queued, only gets lines in its format
+    std::string late;
+    std::atomic<int> gated(0);
+    std::atomic<bool> entered(false);
+    std::atomic<bool> release(false);
+
+    yalo::Logger::addSink(std::unique_ptr<GateSink>(new GateSink("slow", gated, entered, release)));
+    lErr << "slow";
+    waitFor(entered);
+    lErr << "queued before";
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(late)), yalo::Debug,
+                          yalo::Logger::SharedFormatter(new BracketFormatter()));
+    lErr << "queued after";
+    release = true;
+    yalo::Logger::flush();
+    yalo::Logger::setSynchronous();
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+    yalo::Logger::resetLevels(yalo::Error);
+
+    const auto success = console.find("] both\n") != std::string::npos && console.find("verbose") == std::string::npos
+                      && console.find("] queued\n") != std::string::npos && console.find("nobody") == std::string::npos
+                      && verbose.find("<both>\n<verbose>\n<queued>\n<queued verbose>\n") == 0 && copy == verbose
+                      && late == "<queued after>\n"
+                      && 2 == synchronousCalls && 7 == calls.load()
+                      && after.filtered - before.filtered == 1 && after.emitted - before.emitted == 2;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testSinkLevels() => calls %d\n", calls.load());
+        fprintf(stderr, "[%s][%s][%s][%s]\n", console.c_str(), verbose.c_str(), copy.c_str(), late.c_str());
+    }
+
+    return success;
+}
+
+static void timedSleep() {
+    lTimeScope("test.sleep");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+}
+
+static bool testTimeScope() {
+    std::string log;
+    std::atomic<bool> reportSeen(false);
+    const yalo::TimingSummary* sleep = nullptr;
+    const yalo::TimingSummary* loop = nullptr;
+    bool hidden = false;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Info);
+    yalo::Logger::addSink(std::unique_ptr<WatchSink>(new WatchSink(log, "Timing test.sleep: count 1 ", reportSeen)));
+    yalo::Logger::takeTimings(); // forget what earlier tests timed
+
+    for (int call = 0; call < 3; ++call) {
+        timedSleep();
+    }
+
+    for (int call = 0; call < 100; ++call) {
+        YALO_TIME_SCOPE(yalo::Info, "test.loop");
+        YALO_TIME_SCOPE(yalo::Debug, "test.hidden");
+    }
+
+    const auto timings = yalo::Logger::takeTimings();
+
+    for (const auto& summary : timings) {
+        sleep = ::strcmp(summary.name, "test.sleep") == 0 ? &summary : sleep;
+        loop = ::strcmp(summary.name, "test.loop") == 0 ? &summary : loop;
+        hidden = hidden || ::strcmp(summary.name, "test.hidden") == 0;
+    }
+
+    const auto taken = yalo::Logger::takeTimings().empty();
+
+    timedSleep();
+    yalo::Logger::logTimings();
+
+    const auto logged = log;
+
+    reportSeen = false;
+    timedSleep();
+    yalo::Logger::setTimingReport(1);
+
+    const auto seen = waitFor(reportSeen);
+
+    yalo::Logger::setTimingReport(0);
+
+    const auto reported = log.substr(logged.size());
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+    yalo::Logger::resetLevels(yalo::Error);
+
+    const auto success = nullptr != sleep && nullptr != loop && !hidden && taken
+                      && 3 == sleep->count && sleep->min >= 2000000 && sleep->min <= sleep->p50
+                      && sleep->p50 <= sleep->p99 && sleep->p99 <= sleep->max && ::strcmp(sleep->function, "timedSleep") == 0
+                      && yalo::Info == sleep->level && 100 == loop->count && loop->max >= loop->min
+                      && logged.find("[timedSleep] Timing test.sleep: count 1 min ") != std::string::npos
+                      && logged.find("ms p50 ") != std::string::npos && logged.find("test.loop") == std::string::npos
+                      && seen && reported.find("Timing test.sleep: count 1 ") != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testTimeScope() => timings %d hidden %d taken %d\n", static_cast<int>(timings.size()),
+                hidden ? 1 : 0, taken ? 1 : 0);
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static bool testStats() {
+    std::string log;
+    std::atomic<bool> reportSeen(false);
+    std::atomic<int> gated(0);
+    std::atomic<bool> entered(false);
+    std::atomic<bool> release(false);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Error);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    const auto before = yalo::Logger::stats();
+
+    lErr << "shown";
+    lDebug << "hidden";
+    std::thread([]() {lErr << "from a thread that exits";}).join();
+
+    const auto after = yalo::Logger::stats();
+    const auto logged = log.size();
+
+    yalo::Logger::addSink(std::unique_ptr<ThrowingSink>(new ThrowingSink()));
+    lErr << "fails";
+
+    const auto failed = yalo::Logger::stats();
+
+    // one line held in the sink while three more wait in the queue, all four are not written yet
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<GateSink>(new GateSink("slow", gated, entered, release)));
+    yalo::Logger::setAsynchronous(16);
+    lErr << "slow";
+    waitFor(entered);
+    lErr << "one";
+    lErr << "two";
+    lErr << "three";
+
+    const auto queued = yalo::Logger::stats();
+
+    release = true;
+    yalo::Logger::flush();
+
+    const auto drained = yalo::Logger::stats();
+
+    yalo::Logger::setSynchronous();
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<WatchSink>(new WatchSink(log, "Logger stats: requested", reportSeen)));
+    yalo::Logger::setStatsReport(1, countStatsReport);
+
+    for (int attempt = 0; attempt < 5000 && statsReports() == 0; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    yalo::Logger::setStatsReport(1);
+
+    const auto seen = waitFor(reportSeen);
+
+    yalo::Logger::setStatsReport(0);
+
+    const auto reported = seen && log.find("Logger stats: requested") != std::string::npos
+                       && log.find(" lines ") != std::string::npos;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    uint64_t writes = 0;
+
+    for (const auto count : after.sinks.empty() ? std::vector<uint64_t>() : after.sinks[0].latency) {
+        writes += count;
+    }
+
+    const auto success = after.requested - before.requested == 3 && after.filtered - before.filtered == 1
+                      && after.emitted - before.emitted == 2 && after.bytes - before.bytes == logged
+                      && after.sinks.size() == 1 && after.sinks[0].lines == 2 && after.sinks[0].bytes == logged
+                      && after.sinks[0].batches == 2 && writes == 1 && after.sinks[0].latencyPercentile(0.5) >= 1
+                      && failed.failedSinks - after.failedSinks == 1 && failed.sinks.size() == 1
+                      && queued.queueDepth == 4 && drained.queueDepth == 0 && drained.queueHighWater >= 3
+                      && statsReports() > 0 && reported;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testStats() => requested %d filtered %d emitted %d depth %d high %d reports %d\n",
+                static_cast<int>(after.requested - before.requested), static_cast<int>(after.filtered - before.filtered),
+                static_cast<int>(after.emitted - before.emitted), static_cast<int>(queued.queueDepth),
+                static_cast<int>(drained.queueHighWater), statsReports().load());
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static bool testFlightRecorder() {
+    std::string log;
+    std::atomic<bool> dumpEnded(false);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Error);
+    yalo::Logger::addSink(std::unique_ptr<WatchSink>(new WatchSink(log, "Flight recorder: end", dumpEnded)));
+    yalo::Logger::setFlightRecorder(4, yalo::Debug, 16);
+
+    for (int line = 1; line <= 6; ++line) {
+        lDebug << "recorded " << line;
+    }
+
+    lTrace << "too verbose";
+    lErr << "shown";
+
+    const auto beforeDump = log;
+
+    yalo::Logger::dumpFlightRecorder();
+
+    const auto dumped = log.substr(beforeDump.size());
+
+    yalo::Logger::dumpFlightRecorder();
+
+    const auto dumpedTwice = log.size() != beforeDump.size() + dumped.size();
+
+    yalo::Logger::setFlightRecorder(4, yalo::Debug, 64);
+    {
+        yalo::Context request("req", 17);
+
+        lDebug << "in context" << yalo::kv("shard", 2);
+    }
+    {
+        yalo::Context dumper("dumper", 1);
+
+        yalo::Logger::dumpFlightRecorder();
+    }
+
+    const auto withFields = log.substr(beforeDump.size() + dumped.size());
+
+    log.resize(beforeDump.size() + dumped.size());
+    yalo::Logger::setFlightRecorder(4, yalo::Debug, 16);
+    lDebug << "a line much longer than sixteen bytes";
+    yalo::Logger::dumpFlightRecorderOnSignal(SIGUSR1);
+    dumpEnded = false;
+    ::raise(SIGUSR1);
+
+    const auto signalDumped = waitFor(dumpEnded);
+
+    yalo::Logger::setFlightRecorder(0);
+    ::signal(SIGUSR1, SIG_DFL);
+    lDebug << "not recorded";
+    yalo::Logger::dumpFlightRecorder();
+
+    const auto signaled = log.size() > beforeDump.size() + dumped.size() ? log.substr(beforeDump.size() + dumped.size())
+                                                                         : std::string();
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto first = dumped.find("recorded 3");
+    const auto last = dumped.find("recorded 6");
+    const auto success = beforeDump.find("recorded") == std::string::npos && beforeDump.find("shown") != std::string::npos
+                      && dumped.find("Flight recorder: 4 lines") != std::string::npos && dumped.find("recorded 2") == std::string::npos
+                      && first != std::string::npos && last != std::string::npos && first < last
+                      && dumped.find("too verbose") == std::string::npos
+                      && !dumpedTwice && signalDumped && withFields.find("] in context req=17 shard=2\n") != std::string::npos
+                      && signaled.find("a line much long\n") != std::string::npos
+                      && signaled.find("recorded") == std::string::npos && signaled.find("not recorded") == std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testFlightRecorder() => [%s] [%s] [%s] [%s]\n", beforeDump.c_str(), dumped.c_str(),
+                withFields.c_str(), signaled.c_str());
+    }
+
+    return success;
+}
+
+static bool testAsynchronousDrop() {
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Info);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<SlowSink>(new SlowSink(log)));
+    yalo::Logger::setAsynchronous(16, yalo::Logger::OverflowDropBelowLevel, yalo::Warning);
+
+    for (int i = 0; i < 100; ++i) {
+        lInfo << "--dropped--" << i;
+    }
+
+    for (int i = 0; i < 20; ++i) {
+        lWarn << "--kept--" << i;
+    }
+
+    yalo::Logger::setSynchronous();
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    size_t kept = 0;
+
+    for (size_t found = log.find("--kept--"); found != std::string::npos; found = log.find("--kept--", found + 1)) {
+        kept += 1;
+    }
+
+    const auto lines = std::count(log.begin(), log.end(), '\n');
+    const auto success = kept == 20 && lines < 120;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testAsynchronousDrop() => lines = %d kept = %d\n",
+                static_cast<int>(lines), static_cast<int>(kept));
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static void thread_named(std::string* log) {
+    yalo::Logger::setThreadName("worker");
+    lLog << "named";
+    yalo::Logger::setThreadName("");
+    lLog << "unnamed";
+    *log += yalo::Logger::threadName();
+}
+
+static bool testThreadName() {
+    yalo::Logger::clearSinks();
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    std::thread named(thread_named, &log);
+
+    named.join();
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = log.find("][worker][LOG]") != std::string::npos
+                      && log.find("][worker][LOG]", log.find("unnamed")) == std::string::npos
+                      && yalo::Logger::threadName().empty();
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testThreadName()\n");
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static bool testDatePrecision() {
+    const auto milliseconds = yalo::DefaultFormatter::date(yalo::DefaultFormatter::GMT);
+    const auto microseconds = yalo::DefaultFormatter::date(yalo::DefaultFormatter::GMT,
+                                                           yalo::DefaultFormatter::Microseconds);
+    const auto nanoseconds = yalo::DefaultFormatter::date(yalo::DefaultFormatter::GMT,
+                                                          yalo::DefaultFormatter::Nanoseconds);
+    const auto local = yalo::DefaultFormatter::date(yalo::DefaultFormatter::Local);
+    const auto again = yalo::DefaultFormatter::date(yalo::DefaultFormatter::Local);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(
+        new yalo::DefaultFormatter(yalo::DefaultFormatter::GMT, yalo::DefaultFormatter::Microseconds)));
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    lLog << "precise";
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+    yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(new yalo::DefaultFormatter()));
+
+    const auto success = milliseconds.size() == 29 && milliseconds[19] == '.' && milliseconds[23] == ' '
+                      && microseconds.size() == 32 && microseconds[26] == ' '
+                      && nanoseconds.size() == 35 && nanoseconds[29] == ' '
+                      && local.size() == again.size() && local.size() == 35
+                      && log.find(" (") == 27;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testDatePrecision()\n");
+        fprintf(stderr, "[%s][%s][%s][%s][%s]\n", milliseconds.c_str(), microseconds.c_str(),
+                nanoseconds.c_str(), local.c_str(), log.c_str());
+    }
+
+    return success;
+}
+
+static bool testFormatInto() {
+    yalo::DefaultFormatter formatter(yalo::DefaultFormatter::GMT);
+    const yalo::Logger logger(yalo::Info, "file.cpp", 12, "function", false, "x > 1");
+    std::string buffer = "prefix";
+
+    formatter.formatInto(buffer, "message", 7, 3, logger);
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setFormat(std::unique_ptr<BracketFormatter>(new BracketFormatter()));
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    lLog << "custom";
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+    yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(new yalo::DefaultFormatter()));
+
+    const auto expected = "][3][NFO][file.cpp:12][function][x > 1] message\n";
+    const auto success = buffer.find("prefix[") == 0
+                      && buffer.find(expected) == buffer.size() - ::strlen(expected)
+                      && log == "<custom>\n";
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testFormatInto()\n");
+        fprintf(stderr, "[%s][%s]\n", buffer.c_str(), log.c_str());
+    }
+
+    return success;
+}
+
+static bool testStructuredFormatter() {
+    std::string log;
+    const std::string user("ann \"the\" admin");
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Info);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    lInfo << "plain " << yalo::kv("user", 42) << yalo::kv("ok", true);
+
+    const auto plain = log;
+
+    log.clear();
+    yalo::Logger::setFormat(std::unique_ptr<yalo::StructuredFormatter>(new yalo::StructuredFormatter()));
+    lInfo << "line\none\t" << yalo::kv("user", user) << yalo::kv("id", -7) << yalo::kv("ratio", 0.5)
+          << yalo::kv("ok", false) << yalo::kv("bad", std::nan(""));
+    lWarnIf(1 < 2) << yalo::kv("only", "field");
+    lInfo << "back\\slash\rreturn\x01" "control\x1f" << yalo::kv("key\\", "\x7f");
+
+    const auto json = log;
+
+    log.clear();
+    yalo::Logger::setFormat(std::unique_ptr<yalo::StructuredFormatter>(
+                                new yalo::StructuredFormatter(yalo::StructuredFormatter::Logfmt)));
+    lInfo << "two words" << yalo::kv("user", user) << yalo::kv("shard", 3) << yalo::kv("empty", "");
+
+    const auto logfmt = log;
+
+    log.clear();
+    yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(new yalo::DefaultFormatter()));
+
+    const auto created = createFile("bin/testStructuredFormatterJson.txt", "setFormatJson\n")
+                      && createFile("bin/testStructuredFormatterLogfmt.txt", "setFormatLogfmt\n");
+
+    yalo::Logger::setSettingsFile("bin/testStructuredFormatterJson.txt");
+    lInfo << "json from settings";
+    yalo::Logger::setSettingsFile("bin/testStructuredFormatterLogfmt.txt");
+    lInfo << "logfmt from settings";
+    yalo::Logger::setSettingsFile("bin/nonexistant/path/testStructuredFormatter.txt");
+
+    const auto fromSettings = log;
+    int levelsNamed = 0;
+    const char* const names[] = {"fatal", "log", "error", "warning", "info", "debug", "verbose", "trace"};
+
+    for (int level = 0; level <= static_cast<int>(yalo::Trace); ++level) {
+        levelsNamed += ::strcmp(yalo::StructuredFormatter::levelName(static_cast<yalo::Level>(level)), names[level]) == 0;
+    }
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+    yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(new yalo::DefaultFormatter()));
+
+    const auto success = plain.find("] plain  user=42 ok=true\n") != std::string::npos
+                      && json.find("{\"time\":\"") == 0 && json.find("Z\",\"level\":\"info\",\"thread\":") != std::string::npos
+                      && json.find(",\"function\":\"testStructuredFormatter\",\"message\":\"line\\none\\t\",") != std::string::npos
+                      && json.find("\"user\":\"ann \\\"the\\\" admin\",\"id\":-7,\"ratio\":0.5,\"ok\":false,\"bad\":\"nan\"}\n")
+                         != std::string::npos
+                      && json.find("\"level\":\"warning\"") != std::string::npos
+                      && json.find("\"condition\":\"1 < 2\",\"message\":\"\",\"only\":\"field\"}\n") != std::string::npos
+                      && json.find("\"message\":\"back\\\\slash\\rreturn\\u0001control\\u001f\",\"key\\\\\":\"\x7f\"}\n")
+                         != std::string::npos
+                      && logfmt.find("time=") == 0 && logfmt.find(" level=info thread=") != std::string::npos
+                      && logfmt.find(" function=testStructuredFormatter message=\"two words\" user=\"ann \\\"the\\\" admin\""
+                                     " shard=3 empty=\"\"\n") != std::string::npos
+                      && created && fromSettings.find("\"message\":\"Setting format to JSON\"}\n") != std::string::npos
+                      && fromSettings.find("\"message\":\"json from settings\"}\n") != std::string::npos
+                      && fromSettings.find(" message=\"logfmt from settings\"\n") != std::string::npos
+                      && 8 == levelsNamed;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testStructuredFormatter()\n");
+        fprintf(stderr, "[%s][%s][%s][%s]\n", plain.c_str(), json.c_str(), logfmt.c_str(), fromSettings.c_str());
+    }
+
+    return success;
+}
+
+static bool testContext() {
+    std::string log;
+    const yalo::Context* outside = nullptr;
+    const yalo::Context* restored = nullptr;
+    std::string fromThread = "unset";
+    size_t count = 0;
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Info);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    {
+        yalo::Context request("req", 17);
+
+        {
+            yalo::Context tenant("tenant", std::string("acme co"));
+
+            lInfo << "inner";
+            std::thread([&fromThread]() {
+                fromThread = nullptr == yalo::Context::current() ? "none" : "leaked";
+            }).join();
+            yalo::Logger::setFormat(std::unique_ptr<yalo::StructuredFormatter>(new yalo::StructuredFormatter()));
+            lInfo << "json" << yalo::kv("shard", 2);
+            yalo::Logger::setFormat(std::unique_ptr<yalo::StructuredFormatter>(
+                                        new yalo::StructuredFormatter(yalo::StructuredFormatter::Logfmt)));
+            lInfo << "logfmt";
+            yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(new yalo::DefaultFormatter()));
+        }
+
+        restored = yalo::Context::current();
+        lInfo << "outer";
+
+        yalo::Fields::Field field;
+        auto fields = restored->fields();
+
+        while (fields.next(field)) {
+            ++count;
+        }
+    }
+
+    outside = yalo::Context::current();
+    lInfo << "none";
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = log.find("] req=17 tenant=acme co inner\n") != std::string::npos
+                      && log.find(",\"req\":17,\"tenant\":\"acme co\",\"message\":\"json\",\"shard\":2}\n") != std::string::npos
+                      && log.find(" req=17 tenant=\"acme co\" message=logfmt\n") != std::string::npos
+                      && log.find("] req=17 outer\n") != std::string::npos && log.find("] none\n") != std::string::npos
+                      && nullptr == outside && nullptr != restored && 1 == count && fromThread == "none";
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testContext() => thread %s fields %d\n", fromThread.c_str(), static_cast<int>(count));
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+static bool testLongMessage() {
+    const std::string chunk(100, 'x');
+    const std::string longChunk(1000, 'y');
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Log);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+
+    lLog << chunk << chunk << "-" << chunk << longChunk << "-end";
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto expected = "] " + chunk + chunk + "-" + chunk + longChunk + "-end\n";
+    const auto success = log.size() > expected.size()
+                      && log.substr(log.size() - expected.size()) == expected;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testLongMessage()\n");
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+template<typename T>
+static std::string numberText(T value) {
+    char buffer[yalo::Number::BufferSize];
+
+    return std::string(buffer, yalo::Number::write(buffer, value));
+}
+
+static bool testNumbers() {
+    int bad = 0;
+
+    bad += numberText(INT64_MIN) == "-9223372036854775808" ? 0 : 1;
+    bad += numberText(UINT64_MAX) == "18446744073709551615" ? 0 : 1;
+    bad += numberText(static_cast<int8_t>(-5)) == "-5" ? 0 : 1;
+    bad += numberText(true) == "1" ? 0 : 1;
+    bad += numberText(0) == "0" ? 0 : 1;
+    bad += numberText(0.1) == "0.1" ? 0 : 1;
+    bad += numberText(0.1f) == "0.1" ? 0 : 1;
+    bad += numberText(-2.5) == "-2.5" ? 0 : 1;
+    bad += numberText(1.0 / 0.0) == "inf" ? 0 : 1;
+    bad += numberText(std::nan("")) == "nan" ? 0 : 1;
+    bad += numberText(1e15) == "1e+15" ? 0 : 1;
+    bad += numberText(123456.0) == "123456" ? 0 : 1;
+    bad += numberText(1e-5) == "1e-05" ? 0 : 1;
+    bad += numberText(0.0001) == "0.0001" ? 0 : 1;
+    bad += numberText(-0.0) == "-0" ? 0 : 1;
+    bad += numberText(5e-324) == "5e-324" ? 0 : 1;
+    bad += numberText(1.0f / 3.0f) == "0.33333334" ? 0 : 1;
+    bad += numberText(static_cast<const void*>(nullptr)) == "0" ? 0 : 1;
+    bad += numberText(reinterpret_cast<const void*>(0xABC)) == "0xabc" ? 0 : 1;
+
+    const double values[] = {1.0 / 3.0, 2.0 / 3.0, 1e300, 5e-324, 123456789.123456789};
+
+    for (auto value : values) {
+        const double readBack = ::strtod(numberText(value).c_str(), nullptr);
+
+        bad += ::memcmp(&readBack, &value, sizeof(value)) == 0 ? 0 : 1;
+    }
+
+    const long double third = 1.0L / 3.0L;
+    const long double thirdBack = ::strtold(numberText(third).c_str(), nullptr);
+
+    bad += !(thirdBack < third) && !(third < thirdBack) ? 0 : 1;
+
+    const auto success = (0 == bad);
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testNumbers() %d\n", bad);
+    }
+
+    return success;
+}
+
+static bool testNumberLocale() {
+    const char* const commaLocales[] = {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR",
+                                        "nl_NL.UTF-8", "ru_RU.UTF-8"};
+    const char* comma = nullptr;
+    std::string log;
+    char printed[32];
+
+    for (const auto name : commaLocales) {
+        if (nullptr == comma && nullptr != ::setlocale(LC_NUMERIC, name)) {
+            ::snprintf(printed, sizeof(printed), "%g", 2.5);
+            comma = std::string(printed) == "2,5" ? name : nullptr;
+        }
+    }
+
+    if (nullptr == comma) {
+        fprintf(stderr, "testNumberLocale(): no comma decimal locale installed, checking the C locale only\n");
+    }
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterAsIs);
+    yalo::Logger::resetLevels(yalo::Log);
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    lLog << "plain " << 2.5 << " " << 0.5f << " " << 1e-7;
+    yalo::Logger::setFormat(std::unique_ptr<yalo::StructuredFormatter>(new yalo::StructuredFormatter()));
+    lLog << "json" << yalo::kv("ratio", 2.5);
+    yalo::Logger::setFormat(std::unique_ptr<yalo::DefaultFormatter>(new yalo::DefaultFormatter()));
+    ::setlocale(LC_NUMERIC, "C");
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    const auto success = log.find("] plain 2.5 0.5 1e-07\n") != std::string::npos
+                      && log.find(",\"ratio\":2.5}\n") != std::string::npos && log.find("2,5") == std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testNumberLocale() => %s\n", nullptr == comma ? "C" : comma);
+        fprintf(stderr, "[%s]\n", log.c_str());
+    }
+
+    return success;
+}
+
+template<typename T>
+static void appendBytes(std::string& bytes, T value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static std::string binarySite(uint32_t id, uint8_t level) {
+    std::string bytes(1, yalo::BinaryLog::SiteEntry);
+
+    appendBytes(bytes, id);
+    appendBytes(bytes, level);
+    appendBytes(bytes, static_cast<int32_t>(1));
+
+    for (int text = 0; text < 3; ++text) { // file, function, condition
+        appendBytes(bytes, static_cast<uint32_t>(yalo::BinaryLog::NoString));
+    }
+
+    return bytes;
+}
+
+static std::string binaryLine(uint32_t id, const std::string& arguments) {
+    std::string bytes(1, yalo::BinaryLog::LineEntry);
+
+    appendBytes(bytes, id);
+    appendBytes(bytes, static_cast<int64_t>(0));
+    appendBytes(bytes, static_cast<uint64_t>(0));
+    appendBytes(bytes, static_cast<uint8_t>(1));
+    appendBytes(bytes, static_cast<uint32_t>(arguments.size()));
+    return bytes + arguments;
+}
+
+static std::string decodeFailure(const std::string& path, const std::string& contents) {
+    std::string decoded;
+    DebugSink sink(decoded);
+    yalo::BinaryDecoder decoder;
+    std::string failure = "no exception";
+
+    if (!createFile(path, contents)) {
+        return "unable to create " + path;
+    }
+
+    const auto input = ::fopen(path.c_str(), "rb");
+
+    if (nullptr == input) {
+        return "unable to open " + path;
+    }
+
+    try {
+        decoder.decode(input, sink);
+    } catch(const yalo::BinaryDecoder::RuntimeError& exception) {
+        failure = exception.what();
+    }
+
+    ::fclose(input);
+    return failure;
+}
+
+static bool testBinaryLog() {
+    const char* const path = "bin/testBinaryLog.bin";
+    const char* const badPath = "bin/testBinaryLogBad.bin";
+    const int value = 5;
+    const void* const pointer = &value;
+
+    ::remove(path);
+    yalo::Logger::clearSinks();
+    yalo::Logger::setInserterSpacing(yalo::Logger::InserterPad);
+    yalo::Logger::resetLevels(yalo::Error);
+    std::string log;
+    yalo::Logger::addSink(std::unique_ptr<DebugSink>(new DebugSink(log)));
+    yalo::Logger::setBinaryLog(path);
+
+    for (int repeat = 0; repeat < 2; ++repeat) {
+        lLog << "count" << 42 << -7 << 2.5 << 0.1f << std::string("text") << true;
+    }
+
+    lLog << "more" << 42u << pointer << 2.5L;
+    yalo::Logger::setThreadName("worker");
+    lErrIf(value > 1) << "big";
+    yalo::Logger::setThreadName("");
+    yalo::Logger(yalo::Log, "manual.cpp", 3, "manual") << "manual";
+    yalo::Logger::setBinaryLog("");
+
+    yalo::Logger::clearSinks();
+    yalo::Logger::addSink(std::unique_ptr<NullSink>(new NullSink()));
+
+    std::string decoded;
+    DebugSink decodedSink(decoded);
+    yalo::BinaryDecoder decoder(yalo::DefaultFormatter::GMT);
+    const auto input = ::fopen(path, "rb");
+
+    if (nullptr != input) {
+        decoder.decode(input, decodedSink);
+        ::fclose(input);
+    }
+
+    const auto contents = readFileContents(path);
+    const std::string header(yalo::BinaryLog::magic(), yalo::BinaryLog::MagicSize);
+    const std::string site = header + binarySite(1, static_cast<uint8_t>(yalo::Log));
+    std::string badString(1, yalo::BinaryLog::StringArgument);
+    int failures = 0;
+
+    appendBytes(badString, static_cast<uint32_t>(100));
+    badString += "short";
+
+    const struct {
+        std::string contents;
+        const char* failure;
+    } bad[] = {
+        {contents.substr(0, 4), "Truncated binary log"},
+        {contents.substr(0, header.size() + 1), "Truncated binary log"},
+        {contents.substr(0, contents.size() - 1), "Truncated binary log"},
+        {"yalobin0", "Not a yalo binary log"},
+        {header + "X", "Corrupt binary log"},
+        {header + binarySite(1, 200), "Invalid level in binary log: 200"},
+        {site + binaryLine(2, ""), "Unknown call site in binary log: 2"},
+        {site + binaryLine(1, "x"), "Corrupt binary log arguments"},
+        {site + binaryLine(1, "i123"), "Truncated binary log arguments"},
+        {site + binaryLine(1, badString), "Truncated binary log arguments"},
+    };
+
+    for (const auto& test : bad) {
+        const auto failure = decodeFailure(badPath, test.contents);
+
+        if (failure != test.failure) {
+            fprintf(stderr, "FAIL: testBinaryLog() => expected '%s' got '%s'\n", test.failure, failure.c_str());
+            failures += 1;
+        }
+    }
+
+    const std::string repeated = "[LOG][src/tests/test_yalo.cpp:";
+    const auto first = decoded.find("][testBinaryLog] count 42 -7 2.5 0.1 text 1\n");
+    const auto second = decoded.find("][testBinaryLog] count 42 -7 2.5 0.1 text 1\n", first + 1);
+    const auto more = "][testBinaryLog] more 42 " + numberText(pointer) + " 2.5\n";
+    const auto success = log.empty() && 0 == failures
+                      && first != std::string::npos && second != std::string::npos
+                      && decoded.find(more) != std::string::npos
+                      && decoded.find("][worker][ERR][src/tests/test_yalo.cpp:") != std::string::npos
+                      && decoded.find("][testBinaryLog][value > 1] big\n") != std::string::npos
+                      && decoded.find("][LOG][manual.cpp:3][manual] manual\n") != std::string::npos
+                      && decoded.find(repeated) != std::string::npos;
+
+    if (!success) {
+        fprintf(stderr, "FAIL: testBinaryLog()\n");
+        fprintf(stderr, "[%s][%s]\n", log.c_str(), decoded.c_str());
+    }
+
+    return success;
+}
+
 int main(const int /*argc*/, const char* const /*argv*/[]) {
     int failures = 0;
     enum TestEnum {One, Two, Three};
@@ -723,6 +2714,38 @@ int main(const int /*argc*/, const char* const /*argv*/[]) {
     failures += testCommandFile() ? 0 : 1;
     failures += testCommandFileCreated() ? 0 : 1;
     failures += testCommandFileUpdated() ? 0 : 1;
+    failures += testCommandFilePolled() ? 0 : 1;
     failures += testConditionals() ? 0 : 1;
+    failures += testDisabledNotEvaluated() ? 0 : 1;
+    failures += testCallSiteCache() ? 0 : 1;
+    failures += testLevelsWhileReading() ? 0 : 1;
+    failures += testFilePatternMatcher() ? 0 : 1;
+    failures += testThreadName() ? 0 : 1;
+    failures += testDatePrecision() ? 0 : 1;
+    failures += testFormatInto() ? 0 : 1;
+    failures += testStructuredFormatter() ? 0 : 1;
+    failures += testContext() ? 0 : 1;
+    failures += testLongMessage() ? 0 : 1;
+    failures += testSinksInParallel() ? 0 : 1;
+    failures += testReentrantSink() ? 0 : 1;
+    failures += testSinkLevels() ? 0 : 1;
+    failures += testStats() ? 0 : 1;
+    failures += testTimeScope() ? 0 : 1;
+    failures += testFlightRecorder() ? 0 : 1;
+    failures += testAsynchronous() ? 0 : 1;
+    failures += testAsynchronousThreadExit() ? 0 : 1;
+    failures += testAsynchronousDrop() ? 0 : 1;
+    failures += testNumbers() ? 0 : 1;
+    failures += testNumberLocale() ? 0 : 1;
+    failures += testBinaryLog() ? 0 : 1;
+    failures += testCompiledOut() ? 0 : 1;
+    failures += testTraceCounters() ? 0 : 1;
+    failures += testRateLimited() ? 0 : 1;
+    failures += testSinkBatch() ? 0 : 1;
+    failures += testBufferedFileSink() ? 0 : 1;
+    failures += testMappedFileSink() ? 0 : 1;
+    failures += testRotatingFileSink() ? 0 : 1;
+    failures += testSyslogSocketSink() ? 0 : 1;
+    failures += testNetworkSink() ? 0 : 1;
     return failures;
 }
@@ -0,0 +1,52 @@
+#define DISABLE_YALO_TRACE
+#include "../yalo/yalo.h"
+
+/*
+    Writes a file recorded with yalo::Logger::setBinaryLog() to stdout as text.
+    usage: yalo_decode [--gmt] [--us|--ns] file
+*/
+int main(const int argc, const char* const argv[]) {
+    auto location = yalo::DefaultFormatter::Local;
+    auto precision = yalo::DefaultFormatter::Milliseconds;
+    const char* path = nullptr;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        const std::string option = argv[arg];
+
+        if (option == "--gmt") {
+            location = yalo::DefaultFormatter::GMT;
+        } else if (option == "--us") {
+            precision = yalo::DefaultFormatter::Microseconds;
+        } else if (option == "--ns") {
+            precision = yalo::DefaultFormatter::Nanoseconds;
+        } else {
+            path = argv[arg];
+        }
+    }
+
+    if (nullptr == path) {
+        fprintf(stderr, "usage: %s [--gmt] [--us|--ns] file\n", argv[0]);
+        return 1;
+    }
+
+    const auto input = ::fopen(path, "rb");
+
+    if (nullptr == input) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, ::strerror(errno));
+        return 1;
+    }
+
+    yalo::StdOutSink output;
+    yalo::BinaryDecoder decoder(location, precision);
+    int result = 0;
+
+    try {
+        decoder.decode(input, output);
+    } catch(const std::exception& exception) {
+        fprintf(stderr, "%s: %s\n", path, exception.what());
+        result = 1;
+    }
+
+    ::fclose(input);
+    return result;
+}
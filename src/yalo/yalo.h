@@ -24,18 +24,175 @@ If you feel generous, you can submit your changes back to the original work.
 #include <string.h>
 #include <map>
 #include <syslog.h>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <cmath>
+#include <limits>
+#include <cstdlib>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <spawn.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#elif defined(__APPLE__)
+#include <sys/event.h>
+#endif
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
 
-#define lFatal yalo::Logger(yalo::Fatal, __FILE__, __LINE__, __func__)
-#define lFatalIf(condition) yalo::Logger(yalo::Fatal, __FILE__, __LINE__, __func__, condition, #condition)
-#define lLog yalo::Logger(yalo::Log, __FILE__, __LINE__, __func__)
-#define lErr yalo::Logger(yalo::Error, __FILE__, __LINE__, __func__)
-#define lErrIf(condition) yalo::Logger(yalo::Error, __FILE__, __LINE__, __func__, condition, #condition)
-#define lWarn yalo::Logger(yalo::Warning, __FILE__, __LINE__, __func__)
-#define lWarnIf(condition) yalo::Logger(yalo::Warning, __FILE__, __LINE__, __func__, condition, #condition)
-#define lInfo yalo::Logger(yalo::Info, __FILE__, __LINE__, __func__)
-#define lDebug yalo::Logger(yalo::Debug, __FILE__, __LINE__, __func__)
-#define lVerbose yalo::Logger(yalo::Verbose, __FILE__, __LINE__, __func__)
-#define lTrace yalo::Logger(yalo::Trace, __FILE__, __LINE__, __func__)
+/*
+    Every log statement has its own static CallSite that caches whether it is shown.
+    The level (and condition) is checked before the Logger is constructed,
+    so nothing streamed into a disabled log line is evaluated.
+*/
+#define YALO_CALLSITE(level, condition) \
+    [](const char* yaloFunction) -> const yalo::CallSite& { \
+        static const yalo::CallSite yaloCallSite(level, __FILE__, __LINE__, yaloFunction, condition); \
+        return yaloCallSite; \
+    }(__func__)
+#define YALO_LOG_IF(level, condition, conditionText) \
+    for (const yalo::CallSite* yaloSite = &YALO_CALLSITE(level, conditionText); \
+         nullptr != yaloSite && (condition) && yaloSite->enabled(); \
+         yaloSite = nullptr) \
+        yalo::Logger(*yaloSite)
+#define YALO_LOG(level) YALO_LOG_IF(level, true, nullptr)
+
+/*
+    Rate limited statements share the same static site, the limit is read the first time it runs.
+    Once a line is logged again, it starts with how many were suppressed since the last one.
+*/
+#define YALO_RATESITE(level, kind, amount) \
+    [](const char* yaloFunction, uint64_t yaloAmount) -> const yalo::RateLimitedSite& { \
+        static const yalo::RateLimitedSite yaloRateSite(level, __FILE__, __LINE__, yaloFunction, kind, yaloAmount); \
+        return yaloRateSite; \
+    }(__func__, amount)
+#define YALO_LOG_LIMITED(level, kind, amount) \
+    for (const yalo::RateLimitedSite* yaloSite = &YALO_RATESITE(level, kind, amount); \
+         nullptr != yaloSite && yaloSite->enabled() && yaloSite->allowed(); \
+         yaloSite = nullptr) \
+        yalo::Logger(*yaloSite)
+#define YALO_LOG_EVERY(level, n) YALO_LOG_LIMITED(level, yalo::RateLimitedSite::Every, n)
+#define YALO_LOG_PER_SECOND(level, k) YALO_LOG_LIMITED(level, yalo::RateLimitedSite::PerSecond, k)
+
+/*
+    Times the rest of the enclosing scope into the site's histogram, while the level is shown.
+    The name must be a string literal, and Logger::setTimingReport() logs a summary of each site.
+*/
+#define YALO_CONCAT_(a, b) a##b
+#define YALO_CONCAT(a, b) YALO_CONCAT_(a, b)
+#define YALO_TIMESITE(level, name) \
+    [](const char* yaloFunction) -> const yalo::TimingSite& { \
+        static const yalo::TimingSite yaloTimingSite(level, __FILE__, __LINE__, yaloFunction, name); \
+        return yaloTimingSite; \
+    }(__func__)
+#define YALO_TIME_SCOPE(level, name) \
+    const yalo::TimeScope YALO_CONCAT(yaloTimeScope, __LINE__)(YALO_TIMESITE(level, name))
+
+/*
+    Levels more detailed than YALO_MIN_LEVEL are removed at compile time,
+    their statements (and conditions) are never evaluated.
+    0 = Fatal, 1 = Log, 2 = Error, 3 = Warning, 4 = Info, 5 = Debug, 6 = Verbose, 7 = Trace
+*/
+#ifndef YALO_MIN_LEVEL
+#define YALO_MIN_LEVEL 7 // everything is compiled in
+#endif
+#if YALO_MIN_LEVEL < 0 || YALO_MIN_LEVEL > 7
+#error YALO_MIN_LEVEL must be from 0 (Fatal) to 7 (Trace)
+#endif
+#define YALO_LOG_OFF_IF(condition) \
+    for (bool yaloOff = false; yaloOff && (condition); yaloOff = false) \
+        yalo::Logger(yalo::Trace, nullptr, 0, nullptr, false)
+#define YALO_LOG_OFF YALO_LOG_OFF_IF(true)
+
+#define lFatal yalo::Logger(YALO_CALLSITE(yalo::Fatal, nullptr))
+#define lFatalIf(condition) YALO_LOG_IF(yalo::Fatal, condition, #condition)
+#if YALO_MIN_LEVEL >= 1
+#define lLog YALO_LOG(yalo::Log)
+#define lLogEvery(n) YALO_LOG_EVERY(yalo::Log, n)
+#define lLogPerSecond(k) YALO_LOG_PER_SECOND(yalo::Log, k)
+#else
+#define lLog YALO_LOG_OFF
+#define lLogEvery(n) YALO_LOG_OFF_IF(n)
+#define lLogPerSecond(k) YALO_LOG_OFF_IF(k)
+#endif
+#if YALO_MIN_LEVEL >= 2
+#define lErr YALO_LOG(yalo::Error)
+#define lErrIf(condition) YALO_LOG_IF(yalo::Error, condition, #condition)
+#define lErrEvery(n) YALO_LOG_EVERY(yalo::Error, n)
+#define lErrPerSecond(k) YALO_LOG_PER_SECOND(yalo::Error, k)
+#else
+#define lErr YALO_LOG_OFF
+#define lErrIf(condition) YALO_LOG_OFF_IF(condition)
+#define lErrEvery(n) YALO_LOG_OFF_IF(n)
+#define lErrPerSecond(k) YALO_LOG_OFF_IF(k)
+#endif
+#if YALO_MIN_LEVEL >= 3
+#define lWarn YALO_LOG(yalo::Warning)
+#define lWarnIf(condition) YALO_LOG_IF(yalo::Warning, condition, #condition)
+#define lWarnEvery(n) YALO_LOG_EVERY(yalo::Warning, n)
+#define lWarnPerSecond(k) YALO_LOG_PER_SECOND(yalo::Warning, k)
+#else
+#define lWarn YALO_LOG_OFF
+#define lWarnIf(condition) YALO_LOG_OFF_IF(condition)
+#define lWarnEvery(n) YALO_LOG_OFF_IF(n)
+#define lWarnPerSecond(k) YALO_LOG_OFF_IF(k)
+#endif
+#if YALO_MIN_LEVEL >= 4
+#define lInfo YALO_LOG(yalo::Info)
+#define lInfoEvery(n) YALO_LOG_EVERY(yalo::Info, n)
+#define lInfoPerSecond(k) YALO_LOG_PER_SECOND(yalo::Info, k)
+#define lTimeScope(name) YALO_TIME_SCOPE(yalo::Info, name)
+#else
+#define lInfo YALO_LOG_OFF
+#define lInfoEvery(n) YALO_LOG_OFF_IF(n)
+#define lInfoPerSecond(k) YALO_LOG_OFF_IF(k)
+#define lTimeScope(name) static_assert(true, name)
+#endif
+#if YALO_MIN_LEVEL >= 5
+#define lDebug YALO_LOG(yalo::Debug)
+#define lDebugEvery(n) YALO_LOG_EVERY(yalo::Debug, n)
+#define lDebugPerSecond(k) YALO_LOG_PER_SECOND(yalo::Debug, k)
+#else
+#define lDebug YALO_LOG_OFF
+#define lDebugEvery(n) YALO_LOG_OFF_IF(n)
+#define lDebugPerSecond(k) YALO_LOG_OFF_IF(k)
+#endif
+#if YALO_MIN_LEVEL >= 6
+#define lVerbose YALO_LOG(yalo::Verbose)
+#define lVerboseEvery(n) YALO_LOG_EVERY(yalo::Verbose, n)
+#define lVerbosePerSecond(k) YALO_LOG_PER_SECOND(yalo::Verbose, k)
+#else
+#define lVerbose YALO_LOG_OFF
+#define lVerboseEvery(n) YALO_LOG_OFF_IF(n)
+#define lVerbosePerSecond(k) YALO_LOG_OFF_IF(k)
+#endif
+#if YALO_MIN_LEVEL >= 7
+#define lTrace YALO_LOG(yalo::Trace)
+#define lTraceEvery(n) YALO_LOG_EVERY(yalo::Trace, n)
+#define lTracePerSecond(k) YALO_LOG_PER_SECOND(yalo::Trace, k)
+#else
+#define lTrace YALO_LOG_OFF
+#define lTraceEvery(n) YALO_LOG_OFF_IF(n)
+#define lTracePerSecond(k) YALO_LOG_OFF_IF(k)
+#endif
+
+#ifndef YALO_INLINE_BUFFER_SIZE
+#define YALO_INLINE_BUFFER_SIZE 256 // bytes of a log message kept on the stack before using the heap
+#endif
 
 namespace yalo {
 
@@ -50,37 +207,583 @@ enum Level {
     Trace = 7,
 };
 
+class Logger;
+class AsyncWriter;
+class BinaryLog;
+class SettingsWatcher;
+class PeriodicTask;
+class FlightRecorder;
+class IFormatter;
+
+struct Record {
+    typedef std::pair<const IFormatter*, std::string> Formatted; // only compared, the sinks own the formatter
+
+    explicit Record(Level lvl=Log, const std::string& text=std::string(), uint64_t time=0)
+        :level(lvl), timestamp(time), line(text), formatted() {}
+
+    Level level;
+    uint64_t timestamp; // steady clock nanoseconds, only used to order records
+    std::string line; // empty when only sinks with their own formatter want the record
+    std::vector<Formatted> formatted; // the line from each formatter that sinks were added with
+};
+
 class ISink {
 public:
     virtual void log(const std::string& line)=0;
+    virtual void logBatch(const Record* records, size_t count); // in order, defaults to log() for each
     virtual ~ISink()=default;
 };
 
-class Logger;
+/*
+    Immutable data that is read without locking and replaced by publishing a new copy.
+    Writers must serialize with each other. Publishing never waits: the previous copy is retired,
+    and deleted by whichever publish or departing reader first finds that no reader can still see it.
+    Readers count themselves on their own thread's stripe, so logging threads do not share a cache line.
+*/
+template<typename T>
+class Snapshot {
+public:
+    typedef std::unique_ptr<T> Ptr;
+
+    class Reader {
+    public:
+        explicit Reader(const Snapshot& snapshot);
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        ~Reader();
+
+        const T& operator*() const;
+        const T* operator->() const;
+
+    private:
+        const Snapshot& _snapshot;
+        std::atomic<size_t>& _readers;
+        const T* _value;
+    };
+
+    explicit Snapshot(Ptr initial);
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot();
+
+    const T& currentNeedsLock() const; // must be serialized with publishNeedsLock()
+    void publishNeedsLock(Ptr next);
+    size_t retired() const; // published over and not deleted yet
+
+    enum {Stripes = 16};
+
+private:
+    struct alignas(64) Stripe {
+        Stripe();
+
+        std::atomic<size_t> readers[2]; // by epoch
+    };
+    struct Retired {
+        const T* value;
+        uint64_t safeAfter; // deleted once this many grace periods have completed
+    };
+    std::atomic<const T*> _current;
+    mutable std::atomic<size_t> _epoch;
+    mutable Stripe _stripes[Stripes];
+    mutable std::atomic<size_t> _retiredCount; // read by every reader, only written when publishing or reclaiming
+    mutable std::mutex _retiredMutex;
+    mutable std::vector<Retired> _retired; // must hold _retiredMutex
+    mutable uint64_t _started; // grace periods, must hold _retiredMutex
+    mutable uint64_t _completed;
+    static size_t _stripe();
+    size_t _readersIn(size_t epoch) const;
+    void _reclaim() const; // never waits, does nothing if another thread is reclaiming
+};
+
+/*
+    A file pattern compiled once so matching a file does not allocate.
+    Patterns with many parts are matched with one Aho-Corasick pass over the file.
+*/
+class FilePattern {
+public:
+    explicit FilePattern(const std::string& pattern="");
+    ~FilePattern()=default;
+
+    bool matches(const char* file) const;
+    const std::string& pattern() const;
+
+    enum {ScanThreshold = 4}; // more needles than this uses the automaton
+
+private:
+    struct Part {
+        std::string name;
+        bool negative;
+    };
+    struct Node {
+        std::vector<std::pair<char, int>> next;
+        int fail;
+        int last; // highest part index matched when reaching this node
+    };
+    std::string _pattern;
+    std::vector<Part> _parts;
+    int _lastEmpty; // highest part index with an empty name (matches everything)
+    std::vector<Node> _nodes;
+    static int _next(const Node& node, char character);
+    void _compile();
+    int _lastMatchScan(const char* file) const;
+    int _lastMatchAutomaton(const char* file) const;
+};
+
+/*
+    Writes numbers as text into a caller buffer of at least BufferSize characters
+    and returns the number of characters written (no terminating nul).
+    Floating point values are written with the fewest digits that read back the same value,
+    found exactly with big integers (Burger and Dybvig's free-format algorithm) rather than through the C library,
+    so the output does not depend on the locale and is the same in every build.
+*/
+class Number {
+public:
+    enum {BufferSize = 64};
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, size_t>::type
+    write(char* buffer, T value);
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, size_t>::type
+    write(char* buffer, T value);
+    static size_t write(char* buffer, float value);
+    static size_t write(char* buffer, double value);
+    static size_t write(char* buffer, long double value);
+    static size_t write(char* buffer, const void* pointer);
+
+private:
+    static size_t _unsigned(char* buffer, unsigned long long value);
+    static size_t _special(char* buffer, long double value);
+    template<typename T>
+    static size_t _shortest(char* buffer, T value, int fixedDigits);
+    template<typename T>
+    static int _digits(T value, char* digits, int& exponent); // value > 0, returns 0.{digits} * 10^exponent
+    static int _digits64(uint64_t r, uint64_t s, uint64_t mPlus, uint64_t mMinus, bool even, char* digits);
+    template<size_t Words>
+    struct Big { // unsigned, only the first size words are used
+        Big();
+
+        size_t size;
+        uint32_t words[Words];
+        void assign(uint32_t value);
+        void shiftLeft(int bits);
+        void multiply(uint32_t factor);
+        void multiplyPow10(int exponent);
+        void subtract(const Big& other); // other must not be larger
+        int bits() const;
+        uint64_t value() const; // the low 64 bits
+        static int compare(const Big& left, const Big& right);
+        static int compareSum(const Big& left, const Big& add, const Big& right); // left + add against right
+    };
+};
+
+/*
+    Characters stored inside the object until they outgrow YALO_INLINE_BUFFER_SIZE.
+*/
+class MessageBuffer {
+public:
+    MessageBuffer();
+    MessageBuffer(const MessageBuffer&) = delete;
+    MessageBuffer& operator=(const MessageBuffer&) = delete;
+    ~MessageBuffer()=default;
+
+    void append(const char* data, size_t size);
+    void append(char character);
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+    void clear();
+
+    enum {InlineSize = YALO_INLINE_BUFFER_SIZE};
+
+private:
+    char _inline[InlineSize];
+    std::unique_ptr<char[]> _heap;
+    char* _data;
+    size_t _size;
+    size_t _capacity;
+    void _grow(size_t minimum);
+};
+
+/*
+    A key and value streamed into a line with yalo::kv(), kept apart from the text for structured formatters.
+    Numbers are written into the object, strings are only pointed to until the line copies them.
+*/
+class KeyValue {
+public:
+    enum Kind {String, Numeric, Boolean};
+
+    template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    KeyValue(const char* name, T number);
+    KeyValue(const char* name, bool flag);
+    KeyValue(const char* name, const char* text);
+    KeyValue(const char* name, const std::string& text);
+    KeyValue(const KeyValue& other);
+    KeyValue& operator=(const KeyValue&) = delete;
+    ~KeyValue()=default;
+
+    const char* key;
+    const size_t keySize;
+    const Kind kind;
+    const char* value() const;
+    size_t valueSize() const;
+
+private:
+    const char* _text; // nullptr when the value is in _number
+    char _number[Number::BufferSize];
+    const size_t _size;
+};
+
+template<typename T>
+KeyValue kv(const char* key, const T& value);
+
+/*
+    Reads the fields of a line in the order they were streamed.
+*/
+class Fields {
+public:
+    struct Field {
+        Field();
+
+        const char* key;
+        size_t keySize;
+        const char* value;
+        size_t valueSize;
+        KeyValue::Kind kind;
+    };
+
+    Fields(const char* data, size_t size);
+    bool empty() const;
+    bool next(Field& field); // false once every field was read
+
+    static void append(MessageBuffer& fields, const KeyValue& field);
+    static void append(MessageBuffer& fields, const Field& field);
+    static size_t encodedSize(const Field& field);
+
+private:
+    const char* _at;
+    const char* _end;
+    static void _append(MessageBuffer& fields, KeyValue::Kind kind, const char* key, size_t keySize,
+                        const char* value, size_t valueSize);
+    static size_t _readSize(const char*& at);
+};
+
+/*
+    Fields that every line logged by this thread carries while the object is in scope, innermost last.
+    The rendered forms are built once here, so formatting a line only appends them.
+*/
+class Context {
+public:
+    template<typename T>
+    Context(const char* key, const T& value);
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+    ~Context();
+
+    static const Context* current(); // nullptr when this thread has no context
+    Fields fields() const; // including the outer contexts
+    const std::string& text() const; // key=value pairs each followed by a space
+    const std::string& json() const; // "key":value pairs each followed by a comma
+    const std::string& logfmt() const; // key=value pairs each preceded by a space
+
+private:
+    const Context* const _parent;
+    std::string _fields;
+    std::string _text;
+    std::string _json;
+    std::string _logfmt;
+    explicit Context(const KeyValue& field);
+    static const Context*& _top();
+    friend class FlightRecorder;
+    class Suspended { // formats lines recorded earlier without this thread's context
+    public:
+        Suspended();
+        Suspended(const Suspended&) = delete;
+        Suspended& operator=(const Suspended&) = delete;
+        ~Suspended();
+
+    private:
+        const Context* const _saved;
+    };
+};
+
+/*
+    Counters that each thread adds to on its own, so counting never shares a cache line between threads.
+    A total sums every live thread's counters and what threads that exited left behind.
+*/
+class ThreadCounters {
+public:
+    enum Counter {Shown, Filtered, Emitted, Bytes, CounterCount};
+
+    static void add(Counter counter, uint64_t amount=1);
+    static uint64_t total(Counter counter);
+
+private:
+    struct Block {
+        Block();
+        Block(const Block&) = delete;
+        Block& operator=(const Block&) = delete;
+        ~Block();
+
+        std::atomic<uint64_t> counts[CounterCount]; // only written by the owning thread
+    };
+    struct Registry {
+        Registry();
+
+        std::mutex mutex;
+        std::vector<const Block*> blocks; // must hold mutex
+        uint64_t retired[CounterCount]; // must hold mutex
+    };
+    static Registry& _registry();
+    static Block& _block();
+};
+
+class CallSite {
+public:
+    CallSite(Level level, const char* file, int line, const char* function, const char* condition=nullptr);
+    CallSite(const CallSite&) = delete;
+    CallSite& operator=(const CallSite&) = delete;
+    ~CallSite()=default;
+
+    bool enabled() const; // counted in Logger::stats()
+
+    const Level level;
+    const char* const file;
+    const int line;
+    const char* const function;
+    const char* const condition;
+
+private:
+    friend class BinaryLog;
+    friend class Logger;
+    friend class TimingSite;
+    mutable std::atomic<uint64_t> _state; // (levels generation << 2) | LevelState
+    enum LevelState {Shown = 1, Recorded = 2}; // recorded lines go to the flight recorder instead of the sinks
+    bool _shown() const;
+    uint64_t _levelState() const;
+    mutable std::atomic<uint64_t> _binaryId; // (binary log file generation << 32) | id in that file
+};
+
+/*
+    A call site that lets through one of every n lines (Every)
+    or up to k lines a second (PerSecond, a token bucket holding k tokens).
+    Checking the limit is one atomic operation (or a compare and swap loop) without locks.
+*/
+class RateLimitedSite : public CallSite {
+public:
+    enum Kind {Every, PerSecond};
+
+    RateLimitedSite(Level level, const char* file, int line, const char* function, Kind kind, uint64_t amount);
+    RateLimitedSite(const RateLimitedSite&) = delete;
+    RateLimitedSite& operator=(const RateLimitedSite&) = delete;
+    ~RateLimitedSite()=default;
+
+    bool allowed() const; // counts the line as suppressed if not
+    const char* suppressedSummary() const; // empty if nothing suppressed, else ends in a space; resets the count
+
+    const Kind kind;
+    const uint64_t amount;
+
+private:
+    friend class Logger;
+    const uint64_t _interval; // nanoseconds for each token to come back
+    mutable std::atomic<uint64_t> _count; // Every: lines seen; PerSecond: nanoseconds when the bucket is full
+    mutable std::atomic<uint64_t> _suppressed;
+    static std::atomic<bool>& _summaries();
+    static uint64_t _now();
+};
+
+/*
+    The static state of one traced if, while, or switch.
+*/
+class TraceSite {
+public:
+    TraceSite(const char* flow, const char* expression, const char* file, int line, const char* function);
+    TraceSite(const TraceSite&) = delete;
+    TraceSite& operator=(const TraceSite&) = delete;
+    ~TraceSite()=default;
+
+    bool evaluated(bool result) const;
+    template<typename T>
+    T evaluated(T result) const;
+
+    const char* const flow;
+    const char* const expression;
+    uint64_t taken() const; // if and while true, or switch evaluations
+    uint64_t notTaken() const; // if and while false
+    const TraceSite* next() const; // the site constructed before this one
+    static const TraceSite* first(); // the last site constructed
+
+private:
+    friend class Logger;
+    const CallSite _callsite;
+    mutable std::atomic<uint64_t> _taken;
+    mutable std::atomic<uint64_t> _notTaken;
+    const TraceSite* _next;
+    static std::atomic<const TraceSite*>& _first();
+    static std::atomic<int>& _mode();
+    static std::atomic<uint64_t>& _sampleEvery();
+    bool _counted(std::atomic<uint64_t>& counter) const; // true if the line should be logged
+};
+
+struct TimingSummary {
+    const char* name;
+    const char* file;
+    int line;
+    const char* function;
+    Level level;
+    uint64_t count;
+    uint64_t min; // nanoseconds, as are the rest
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+};
+
+/*
+    The histogram of one lTimeScope, striped so threads on different stripes never share a cache line.
+    Buckets split each power of two nanoseconds in four, so percentiles are within 25%.
+*/
+class TimingSite : public CallSite {
+public:
+    enum {Stripes = 8, Buckets = 160};
+
+    TimingSite(Level level, const char* file, int line, const char* function, const char* name);
+    TimingSite(const TimingSite&) = delete;
+    TimingSite& operator=(const TimingSite&) = delete;
+    ~TimingSite()=default;
+
+    bool measured() const; // whether the level is shown, not counted in Logger::stats()
+    void record(uint64_t nanoseconds) const;
+    TimingSummary take() const; // the summary since the last take
+    const TimingSite* next() const; // the site constructed before this one
+    static const TimingSite* first(); // the last site constructed
+
+    const char* const name;
+
+private:
+    struct alignas(64) Stripe {
+        Stripe();
+
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> min;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> buckets[Buckets];
+    };
+    mutable Stripe _stripes[Stripes];
+    const TimingSite* _next;
+    static std::atomic<const TimingSite*>& _first();
+    static size_t _stripe();
+    static size_t _bucket(uint64_t nanoseconds);
+    static uint64_t _bucketLimit(size_t bucket); // the most nanoseconds the bucket holds
+};
+
+/*
+    Measures from construction to destruction with the steady clock.
+*/
+class TimeScope {
+public:
+    explicit TimeScope(const TimingSite& site);
+    TimeScope(const TimeScope&) = delete;
+    TimeScope& operator=(const TimeScope&) = delete;
+    ~TimeScope();
+
+private:
+    const TimingSite& _site;
+    const bool _measured;
+    const std::chrono::steady_clock::time_point _start;
+};
+
+struct TraceCount {
+    const char* flow;
+    const char* expression;
+    const char* file;
+    int line;
+    const char* function;
+    uint64_t taken;
+    uint64_t notTaken;
+};
+
+struct SinkStats {
+    enum {LatencyBuckets = 24, LatencySampleEvery = 16};
+
+    SinkStats():sink(), batches(0), lines(0), bytes(0), latency(LatencyBuckets, 0) {}
+    uint64_t latencyPercentile(double fraction) const; // microseconds, the upper bound of the bucket
+
+    std::string sink; // type name
+    uint64_t batches;
+    uint64_t lines;
+    uint64_t bytes;
+    std::vector<uint64_t> latency; // timed batches (one in LatencySampleEvery) written in under 2^index microseconds
+};
+
+struct Stats {
+    Stats():requested(0), filtered(0), emitted(0), bytes(0), dropped(0), failedSinks(0), settingsLoads(0),
+            queueDepth(0), queueHighWater(0), sinks() {}
+
+    uint64_t requested; // statements that checked whether to log
+    uint64_t filtered; // of those, the ones whose level was not shown
+    uint64_t emitted; // lines formatted (or recorded in the binary log)
+    uint64_t bytes; // of the emitted lines
+    uint64_t dropped; // by the asynchronous queue
+    uint64_t failedSinks; // sinks removed because they threw
+    uint64_t settingsLoads;
+    size_t queueDepth; // lines waiting for the asynchronous writer
+    size_t queueHighWater; // the most lines that were waiting
+    std::vector<SinkStats> sinks;
+};
 
 class IFormatter {
 public:
     virtual ~IFormatter()=default;
     virtual std::string format(const std::string& line, size_t thread, const Logger& logger)=0;
     virtual std::string format(const std::exception& exception)=0;
+    virtual void formatInto(std::string& buffer, const char* line, size_t size, size_t thread, const Logger& logger);
 };
 
 class Logger {
 public:
     typedef std::unique_ptr<ISink> ISinkPtr;
     typedef std::unique_ptr<IFormatter> IFormatterPtr;
+    typedef std::shared_ptr<IFormatter> SharedFormatter;
     enum InserterSpacing {InserterPad, InserterAsIs};
+    enum Overflow {OverflowBlock, OverflowDropNewest, OverflowDropBelowLevel};
+    enum TraceMode {TraceLines, TraceCounters};
+    typedef std::vector<TraceCount> TraceCounts;
+    typedef std::vector<TimingSummary> TimingSummaries;
+    typedef void (*StatsHook)(const Stats& stats);
 
-    static void addSink(ISinkPtr method);
+    static void addSink(ISinkPtr method, Level level=Trace, SharedFormatter formatter=SharedFormatter()); // lines up to level
     static void clearSinks();
     static void setFormat(IFormatterPtr formatter);
     static void setSettingsFile(const std::string& path, int checkIntervalSeconds=10);
+    static uint64_t settingsLoads(); // times the settings file has been applied
     static void setLevel(Level level, const std::string& pattern="");
     static void resetLevels(Level level);
     static bool shown(Level level, const std::string& file="");
+    static bool shown(Level level, const char* file);
     static void setInserterSpacing(InserterSpacing spacing);
+    static void setAsynchronous(size_t queueSize=1024, Overflow overflow=OverflowBlock, Level keep=Warning);
+    static void setSynchronous();
+    static void flush();
+    static void setThreadName(const std::string& name);
+    static const std::string& threadName();
+    static void setBinaryLog(const std::string& path);
+    static void setTraceMode(TraceMode mode, uint64_t sampleEvery=0);
+    static void setSuppressedSummary(bool summarize);
+    static TraceCounts traceCounts();
+    static void logTraceCounts();
+    static TimingSummaries takeTimings(); // every lTimeScope that ran since the last take
+    static void logTimings();
+    static void setTimingReport(int intervalSeconds); // logs the timings every interval, 0 stops
+    static void setFlightRecorder(size_t lines, Level level=Trace, size_t lineBytes=256); // 0 lines turns it off
+    static void dumpFlightRecorder(); // writes the recorded lines to the sinks and forgets them
+    static void dumpFlightRecorderOnSignal(int signal);
+    static Stats stats();
+    static void setStatsReport(int intervalSeconds, StatsHook hook=nullptr); // 0 stops, without a hook stats are logged
 
     Logger(Level level, const char* file=nullptr, const int line=0, const char* function=nullptr, bool doLog=true, const char* condition=nullptr);
+    explicit Logger(const CallSite& site, bool doLog=true);
+    explicit Logger(const RateLimitedSite& site); // starts with the site's suppressed summary, if any
     Logger(const Logger&) = delete;
     Logger& operator=(const Logger&) = delete;
     ~Logger();
@@ -99,11 +802,11 @@ public:
     Logger& operator<<(float value);
     Logger& operator<<(double value);
     Logger& operator<<(const std::exception& exception);
+    Logger& operator<<(const KeyValue& field);
+    Fields fields() const;
 
-    typedef std::vector<std::thread::id> ThreadList;
     typedef std::lock_guard<std::mutex> Lock;
-    typedef std::vector<ISinkPtr> SinkList;
-    typedef std::map<Level, std::string> FileLevels;
+    typedef std::map<Level, FilePattern> FileLevels;
     typedef std::chrono::system_clock::time_point Timestamp;
 
     const Level levelRequested;
@@ -111,46 +814,166 @@ public:
     const int line;
     const char* function;
     const char* condition;
+    const CallSite* const callsite;
 
 private:
-    std::string _stream;
+    friend class CallSite;
+    friend class FlightRecorder;
+    MessageBuffer _stream;
+    MessageBuffer _fields;
     const bool _doLog;
-    enum Mutex {ThreadListMutex, SinkListMutex, FormatterMutex, LevelsMutex, SettingsMutex};
+    const bool _binary; // _stream holds BinaryLog arguments instead of text
+    enum Mutex {SinkListMutex, FormatterMutex, LevelsMutex, SettingsMutex};
+    struct SinkEntry { // each sink is serialized on its own, so sinks write in parallel
+        explicit SinkEntry(ISinkPtr method, Level most=Trace, SharedFormatter format=SharedFormatter());
+        ISinkPtr sink;
+        const Level level; // the most verbose level the sink takes
+        const SharedFormatter formatter; // nullptr for the logger's formatter
+        std::mutex mutex;
+        std::atomic<uint64_t> batches;
+        std::atomic<uint64_t> lines;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> latency[SinkStats::LatencyBuckets];
+        std::atomic<std::thread::id> writer; // while locked, so a sink that logs skips itself
+    };
+    class HoldSink { // locks a sink entry and marks this thread as its writer
+    public:
+        explicit HoldSink(SinkEntry& entry);
+        HoldSink(const HoldSink&) = delete;
+        HoldSink& operator=(const HoldSink&) = delete;
+        ~HoldSink();
+
+        static bool heldByThisThread(const SinkEntry& entry);
+
+    private:
+        SinkEntry& _entry;
+        Lock _lock;
+    };
+    class Nesting { // counts how deep this thread is in logging, for lines logged while logging
+    public:
+        explicit Nesting(int& depth);
+        Nesting(const Nesting&) = delete;
+        Nesting& operator=(const Nesting&) = delete;
+        ~Nesting();
+
+        bool outermost() const;
+        bool tooDeep() const; // a sink or formatter that logs every time it is called would never stop
+
+        enum {MaxDepth = 4};
+
+    private:
+        int& _depth;
+    };
+    typedef std::shared_ptr<SinkEntry> SinkEntryPtr;
+    typedef std::vector<SinkEntryPtr> SinkList;
     enum Action {Change, NoChange};
     static std::mutex& _mutex(Mutex mutexType);
+    static std::atomic<uint32_t>& _generation(); // bumped whenever levels may have changed
     static size_t _threadIndex();
-    static FileLevels& _levelsNeedsLock(); // must Lock(_mutex(LevelsMutex))
-    static SinkList& _sinksNeedsLock(); // must Lock(_muetx(SinkListMutex))
+    static std::string& _threadNameStorage();
+    static Snapshot<FileLevels>& _levels(); // writers must Lock(_mutex(LevelsMutex))
+    static void _publishLevelsNeedsLock(FileLevels& levels); // must Lock(_mutex(LevelsMutex))
+    static Snapshot<SinkList>& _sinks(); // writers must Lock(_mutex(SinkListMutex))
+    static void _publishSinksNeedsLock(SinkList sinks); // must Lock(_mutex(SinkListMutex))
+    static std::atomic<int>& _sinkLevel(); // the most verbose level any sink takes
+    static bool _wanted(Level level, const char* file); // shown, and some sink takes it
+    static AsyncWriter& _async();
+    static BinaryLog& _binaryLog();
+    static void _writeRecords(const Record* records, size_t count);
+    static const Record* _sinkBatch(const SinkEntry& entry, const Record* records, size_t& count,
+                                    std::vector<Record>& batch); // must hold entry.mutex
     static IFormatterPtr& _formatter(IFormatterPtr update);
     static IFormatterPtr& _formatter();
     static InserterSpacing _spacing(InserterSpacing spacing, Action action=Change);
-    static void _settingsFile(const std::string& path="", int checkIntervalSeconds=0);
-    static std::string _settingsContents(const std::string& path, int checkIntervalSeconds);
-    static bool _fileMatches(const std::string& file, const std::string& pattern);
+    static SettingsWatcher& _settings();
+    static PeriodicTask& _statsReporter();
+    static PeriodicTask& _timingReporter();
+    static std::string _duration(uint64_t nanoseconds);
+    static FlightRecorder& _flightRecorder();
+    static void _crashed(int signal);
+    static std::atomic<StatsHook>& _statsHook();
+    static std::atomic<uint64_t>& _failedSinks();
+    static void _reportStats();
+    static void _addHeld(std::atomic<uint64_t>& counter, uint64_t amount); // only written while holding a lock
+    static void _applySettings(const std::string& contents);
     static std::string _readFile(const std::string& path);
     static Level _fromString(const std::string &level);
     static std::string _trim(const std::string &str);
-    Logger& _append(const std::string& value);
+    Logger& _append(const char* value, size_t size);
+    bool _enabled();
+    bool _recorded();
+    Logger& _logLine(const char* line, size_t size);
+    Logger& _logBinary();
+    Logger& _logLineCore(const char* line, size_t size);
     Logger& _logLineCore(const std::string& line);
 };
 
 class DefaultFormatter : public IFormatter {
 public:
     enum Location { GMT, Local };
-    static std::string date(Location location);
+    enum Precision { Milliseconds, Microseconds, Nanoseconds };
+    static std::string date(Location location, Precision precision=Milliseconds);
     static std::string levelString(Level level);
 
-    DefaultFormatter(Location location=Local);
+    DefaultFormatter(Location location=Local, Precision precision=Milliseconds);
     ~DefaultFormatter()=default;
     virtual std::string format(const std::string& line, size_t thread, const Logger& logger) override;
     virtual std::string format(const std::exception& exception) override;
+    virtual void formatInto(std::string& buffer, const char* line, size_t size, size_t thread, const Logger& logger) override;
+    void formatAt(std::string& buffer, const char* line, size_t size, size_t thread, const std::string& threadName,
+                  const Logger& logger, const Logger::Timestamp& when) const;
 
     typedef std::runtime_error RuntimeError;
 private:
+    struct SecondCache {
+        SecondCache():valid(false), second(0), before(), after() {}
+
+        bool valid;
+        time_t second;
+        std::string before; // up to the seconds
+        std::string after; // zone and day of the week
+    };
     Location _location;
-    static char* _writable(std::string& str);
-    static std::string _ms_str(const std::chrono::system_clock::time_point& time);
-    static std::string& _replace(std::string& str, const std::string& search, const std::string& replace);
+    Precision _precision;
+    static SecondCache& _secondCache(Location location);
+    static void _appendDate(std::string& buffer, Location location, Precision precision, const Logger::Timestamp& when);
+    static void _appendDecimal(std::string& buffer, uint64_t value);
+    static const char* _levelText(Level level);
+};
+
+/*
+    Writes each line as one JSON object, or as logfmt key=value pairs, with the yalo::kv() fields as their own keys.
+    Text is escaped as it is copied into the line, and the time is UTC in RFC 3339.
+*/
+class StructuredFormatter : public IFormatter {
+public:
+    enum Style {Json, Logfmt};
+    static const char* levelName(Level level);
+
+    explicit StructuredFormatter(Style style=Json, DefaultFormatter::Precision precision=DefaultFormatter::Microseconds);
+    ~StructuredFormatter()=default;
+    virtual std::string format(const std::string& line, size_t thread, const Logger& logger) override;
+    virtual std::string format(const std::exception& exception) override;
+    virtual void formatInto(std::string& buffer, const char* line, size_t size, size_t thread, const Logger& logger) override;
+    void appendField(std::string& buffer, const Fields::Field& field, bool first) const;
+
+private:
+    struct SecondCache {
+        SecondCache():valid(false), second(0), text() {}
+
+        bool valid;
+        time_t second;
+        std::string text; // up to the seconds
+    };
+    Style _style;
+    DefaultFormatter::Precision _precision;
+    void _key(std::string& buffer, const char* key, size_t size, bool first) const;
+    void _string(std::string& buffer, const char* value, size_t size) const;
+    void _number(std::string& buffer, const char* value, size_t size) const;
+    void _time(std::string& buffer, const Logger::Timestamp& when) const;
+    static void _escapeJson(std::string& buffer, const char* value, size_t size);
+    static bool _isJsonNumber(const char* value, size_t size);
+    static bool _isBareLogfmt(const char* value, size_t size);
 };
 
 class StreamSink : public ISink {
@@ -162,6 +985,9 @@ public:
     virtual ~StreamSink();
 
     virtual void log(const std::string& line) override;
+    virtual void logBatch(const Record* records, size_t count) override;
+
+    enum {MaxVectors = 64}; // lines written by each writev()
 
 protected:
     std::string _name;
@@ -169,6 +995,7 @@ protected:
 private:
     FILE* _stream;
     bool _close;
+    void _throwError(int error);
 };
 
 class StdErrSink : public StreamSink {
@@ -192,686 +1019,5996 @@ private:
     static FILE* _open(const std::string& path);
 };
 
-class SyslogSink : public ISink {
+/*
+    Appends to a file through its own buffer instead of stdio.
+    Lines are written when the buffer fills, when the oldest buffered line is flushMilliseconds old,
+    or when a line at flushLevel or more important is logged. A whole batch from the asynchronous
+    writer is one write (and at most one fsync). The time limit is checked whenever lines are logged,
+    and every 100 milliseconds by the asynchronous writer while it is idle.
+*/
+class BufferedFileSink : public ISink {
 public:
-SyslogSink()=default;
-    virtual ~SyslogSink()=default;
+    struct Policy {
+        Policy():bufferBytes(256 * 1024), flushMilliseconds(1000), syncSeconds(-1), flushLevel(Error) {}
+
+        size_t bufferBytes; // write once this much is buffered
+        int flushMilliseconds; // write once a line has been buffered this long
+        int syncSeconds; // fsync once this long after the last fsync, 0 after every write, negative never
+        Level flushLevel; // write as soon as these lines are logged
+    };
+
+    explicit BufferedFileSink(const std::string& path, const Policy& policy=Policy());
+    BufferedFileSink(const BufferedFileSink&) = delete;
+    BufferedFileSink& operator=(const BufferedFileSink&) = delete;
+    virtual ~BufferedFileSink();
 
     virtual void log(const std::string& line) override;
-};
-    
-inline void Logger::addSink(ISinkPtr method) {
-    if (method) {
-        Lock protection(_mutex(SinkListMutex));
+    virtual void logBatch(const Record* records, size_t count) override;
+    void flush(); // write what is buffered
+    void sync(); // write what is buffered and fsync
 
-        _sinksNeedsLock().push_back(std::move(method));
-    }
-}
+    typedef std::chrono::steady_clock Clock;
 
-inline void Logger::clearSinks() {
-    Lock protection(_mutex(SinkListMutex));
+private:
+    const std::string _path;
+    const Policy _policy;
+    int _file;
+    std::string _buffer;
+    Clock::time_point _firstBuffered;
+    Clock::time_point _lastSync;
+    bool _unsynced;
+    void _flushIfNeeded(bool urgent);
+    void _write();
+    void _throwError(int error);
+    static int _open(const std::string& path);
+};
 
-    _sinksNeedsLock().clear();
-}
+/*
+    Writes lines by copying them into preallocated, memory mapped segment files
+    ({path}.000000, {path}.000001, ...), with no system call for most lines.
+    Each segment starts with a HeaderSize byte header that holds the number of bytes committed,
+    so a segment left behind by a crash can still be read with MappedFileSink::read().
+    A finished segment is truncated to what was written.
+*/
+class MappedFileSink : public ISink {
+public:
+    explicit MappedFileSink(const std::string& path, size_t segmentBytes=64 * 1024 * 1024);
+    MappedFileSink(const MappedFileSink&) = delete;
+    MappedFileSink& operator=(const MappedFileSink&) = delete;
+    virtual ~MappedFileSink();
 
-inline void Logger::setFormat(IFormatterPtr formatter) {
-    _formatter(std::move(formatter));
-}
+    virtual void log(const std::string& line) override;
+    void sync(); // msync the segment being written
+    const std::string& segmentPath() const;
+    static std::string read(const std::string& segmentPath); // the committed lines in a segment
+    static const char* magic(); // the first bytes of every segment
 
-inline void Logger::setSettingsFile(const std::string& path, int checkIntervalSeconds) {
-    _settingsFile(path, checkIntervalSeconds);
-}
+    enum {HeaderSize = 64, MagicSize = 8, CommittedOffset = 8, CapacityOffset = 16};
+    typedef std::system_error SystemError;
 
-inline void Logger::setLevel(Level level, const std::string& pattern) {
-    /*
-        If you set Error, "" then all files will be shown for Error or Log
-        Any levels higher than Error and have "" set, will be cleared.
-        To clear, the higher levels *must* match the pattern exactly
-    */
-    Lock lock(_mutex(LevelsMutex));
-    auto& levels = _levelsNeedsLock();
-    const auto start = static_cast<int>(level);
-    const auto max = static_cast<int>(Trace);
+private:
+    const std::string _path;
+    const size_t _segmentBytes;
+    size_t _index;
+    std::string _segmentPath;
+    int _file;
+    char* _map;
+    size_t _mapped;
+    uint64_t _committed;
+    void _openSegment(size_t minimum);
+    void _closeSegment();
+    void _throwError(const std::string& action, int error);
+    static std::string _name(const std::string& path, size_t index);
+};
 
-    levels[level] = pattern;
+/*
+    Appends to path until the file reaches maxBytes or the clock passes a multiple of intervalSeconds,
+    then rolls it over to path.1 (path.1 to path.2, and so on) keeping the newest generations.
+    Renaming the generations and compressing them (with gzip or zstd) happens on a background thread,
+    logging only closes the file, renames it, and opens a new one.
+*/
+class RotatingFileSink : public ISink {
+public:
+    enum Compression {NoCompression, Gzip, Zstd};
+    struct Policy {
+        Policy():maxBytes(10 * 1024 * 1024), intervalSeconds(0), generations(5), compression(NoCompression) {}
 
-    for (int index = start; index <= max; ++index) {
-        const auto lvl = static_cast<Level>(index);
+        size_t maxBytes; // 0 to never roll over by size
+        int intervalSeconds; // 0 to never roll over by time
+        size_t generations; // rolled over files kept
+        Compression compression;
+    };
 
-        if (pattern == levels[lvl]) {
-            levels.erase(lvl);
-        }
-    }
-}
+    explicit RotatingFileSink(const std::string& path, const Policy& policy=Policy());
+    RotatingFileSink(const RotatingFileSink&) = delete;
+    RotatingFileSink& operator=(const RotatingFileSink&) = delete;
+    virtual ~RotatingFileSink(); // waits for the background work
 
-inline void Logger::resetLevels(Level level) {
-    Lock lock(_mutex(LevelsMutex));
-    auto& levels = _levelsNeedsLock();
+    virtual void log(const std::string& line) override;
+    void rotate();
+    void waitForRotations(); // every rotation so far is renamed and compressed
+    static Policy policy(const std::string& options); // "maxBytes=10M generations=5 intervalSeconds=3600 compression=gzip"
 
-    levels.clear();
-    levels[level] = "";
-}
+private:
+    const std::string _path;
+    const Policy _policy;
+    std::unique_ptr<FileSink> _file;
+    size_t _size;
+    time_t _nextRotation;
+    time_t _retryAt; // a reopen failed, so keep appending to the current file until then
+    size_t _rotations;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::vector<std::string> _pending; // rolled over files not renamed yet, must hold _mutex
+    bool _busy; // must hold _mutex
+    bool _stopping; // must hold _mutex
+    void _run();
+    void _shift(const std::string& rolledOver);
+    void _compress(const std::string& path);
+    std::string _generation(size_t index, const char* extension) const;
+    time_t _next(time_t now) const;
+    static size_t _fileSize(const std::string& path);
+    static size_t _bytes(const std::string& option, const std::string& value);
+    static size_t _count(const std::string& option, const std::string& value);
+};
 
-inline bool Logger::shown(Level loggedLevel, const std::string& file) {
-    /*
-        If the file has been set to the requested loggedLevel or higher,
-        it can be logged.
-    */
-    Lock lock(_mutex(LevelsMutex));
-    auto& levels = _levelsNeedsLock();
-    const auto start = static_cast<int>(loggedLevel);
-    const auto max = static_cast<int>(Trace);
+class SyslogSink : public ISink {
+public:
+SyslogSink()=default;
+    virtual ~SyslogSink()=default;
 
-    for (int index = start; index <= max; ++index) {
-        const auto level = static_cast<Level>(index);
-        const auto found = levels.find(level);
+    virtual void log(const std::string& line) override; // logged as LOG_NOTICE
+    virtual void logBatch(const Record* records, size_t count) override;
+    static int severity(Level level);
+};
 
-        if (found == levels.end()) {
-            continue; // nothing authorized for this level
-        }
+/*
+    Sends each line as a datagram straight to the syslog socket without libc's syslog lock.
+    The socket never blocks, lines the daemon cannot take yet wait in a bounded queue
+    that is sent (several datagrams per system call where available) on the next write,
+    and lines that do not fit in the queue are dropped and counted.
+*/
+class SyslogSocketSink : public ISink {
+public:
+    enum Protocol {Rfc5424, Journald};
+    struct Policy {
+        Policy():path("/dev/log"), protocol(Rfc5424), identity(), facility(LOG_USER), pendingLines(1024) {}
 
-        if (_fileMatches(file, found->second)) {
-            return true;
-        }
-    }
-    return false;
-}
+        std::string path; // /run/systemd/journal/socket for Journald
+        Protocol protocol;
+        std::string identity; // the program name when empty
+        int facility;
+        size_t pendingLines; // lines kept while the socket is full
+    };
 
-inline void Logger::setInserterSpacing(InserterSpacing spacing) {
-    _spacing(spacing);
-}
+    explicit SyslogSocketSink(const Policy& policy=Policy());
+    SyslogSocketSink(const SyslogSocketSink&) = delete;
+    SyslogSocketSink& operator=(const SyslogSocketSink&) = delete;
+    virtual ~SyslogSocketSink();
 
-inline Logger::Logger(Level level, const char* fl, const int ln, const char* func, bool doLog, const char* cond)
-    :levelRequested(level), file(fl), line(ln), function(func), condition(cond), _stream(), _doLog(doLog) {}
+    virtual void log(const std::string& line) override; // logged as LOG_NOTICE
+    virtual void logBatch(const Record* records, size_t count) override;
+    size_t dropped() const;
+    size_t pending() const;
 
-inline Logger::~Logger() {
-    if (levelRequested != Fatal && (!_doLog || _stream.empty())) {
-        return;
-    }
+    enum {MaxBatch = 64};
 
-    try {
-        log_line(_stream);
-    } catch(...) {
-        // too late
+private:
+    const Policy _policy;
+    const std::string _host;
+    const std::string _identity;
+    int _socket;
+    std::vector<std::string> _pending; // ring of datagrams, reused so steady state does not allocate
+    size_t _head;
+    std::atomic<size_t> _size;
+    std::atomic<size_t> _dropped;
+    void _queue(Level level, const char* line, size_t size, const char* timestamp);
+    void _send();
+    bool _connect();
+    static std::string _hostName();
+    static std::string _programName();
+    static void _timestamp(char* buffer, size_t size);
+};
+
+/*
+    Streams lines to a collector over TCP (or UDP datagrams of whole lines) from its own thread.
+    Logging only appends to a bounded spool, so a slow or missing collector never blocks the caller:
+    lines that do not fit are dropped and counted. The thread sends the spool in large batches
+    and reconnects with exponential backoff, resending a line that was cut off by a disconnect.
+*/
+class NetworkSink : public ISink {
+public:
+    struct Policy {
+        Policy():spoolBytes(4 * 1024 * 1024), batchBytes(64 * 1024), datagramBytes(1472),
+                 reconnectMilliseconds(100), maxReconnectMilliseconds(30000),
+                 connectTimeoutMilliseconds(5000), lingerMilliseconds(1000) {}
+
+        size_t spoolBytes; // most bytes kept while disconnected or behind
+        size_t batchBytes; // most bytes per TCP send
+        size_t datagramBytes; // whole lines are packed into UDP datagrams up to this size
+        int reconnectMilliseconds; // first wait after a failed connect, doubled each time
+        int maxReconnectMilliseconds;
+        int connectTimeoutMilliseconds;
+        int lingerMilliseconds; // how long the destructor keeps sending what is spooled
+    };
+
+    explicit NetworkSink(const std::string& url, const Policy& policy=Policy()); // tcp://host:port or udp://host:port
+    NetworkSink(const NetworkSink&) = delete;
+    NetworkSink& operator=(const NetworkSink&) = delete;
+    virtual ~NetworkSink();
+
+    virtual void log(const std::string& line) override;
+    virtual void logBatch(const Record* records, size_t count) override;
+    bool waitUntilSent(int milliseconds); // true once everything spooled has been sent
+    size_t dropped() const; // lines
+    size_t spooled() const; // bytes
+    size_t connects() const;
+    static bool isUrl(const std::string& text);
+
+private:
+    const Policy _policy;
+    bool _udp;
+    std::string _host;
+    std::string _port;
+    int _socket; // only used by _thread
+    std::string _outgoing; // taken from _incoming, only used by _thread
+    size_t _offset; // sent so far of _outgoing
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::string _incoming; // must hold _mutex
+    std::atomic<bool> _stopping;
+    std::atomic<size_t> _spooled;
+    std::atomic<size_t> _dropped;
+    std::atomic<size_t> _connects;
+    std::thread _thread;
+    void _append(const char* line, size_t size); // must hold _mutex
+    void _run();
+    bool _connect();
+    bool _send();
+    bool _sendDatagram();
+    void _disconnect();
+    bool _wait(int events, int milliseconds);
+};
+
+/*
+    Bounded lock-free ring, one thread pushes and one thread pops.
+*/
+class RecordRing {
+public:
+    explicit RecordRing(size_t capacity);
+    RecordRing(const RecordRing&) = delete;
+    RecordRing& operator=(const RecordRing&) = delete;
+    ~RecordRing()=default;
+
+    bool push(const Record& source, uint64_t timestamp); // false if full
+    const Record* front() const; // nullptr if empty
+    void pop(Record& record); // only after front() returned a record
+    size_t pushed() const;
+    size_t size() const; // only accurate on the consuming thread
+    void close(); // the producing thread exited
+    bool closed() const;
+
+private:
+    const size_t _mask;
+    std::unique_ptr<Record[]> _records;
+    std::atomic<size_t> _head;
+    char _headPadding[64]; // keep the producer and consumer indices on separate cache lines
+    std::atomic<size_t> _tail;
+    size_t _cachedHead;
+    std::atomic<bool> _closed;
+    static size_t _powerOfTwo(size_t minimum);
+};
+
+/*
+    Background thread that drains every thread's ring to the sinks,
+    merging the rings by the time the records were logged.
+    Once started, the thread lives until the program exits.
+*/
+class AsyncWriter {
+public:
+    typedef void (*Write)(const Record* records, size_t count);
+
+    explicit AsyncWriter(Write write);
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+    ~AsyncWriter();
+
+    void start(size_t queueSize, Logger::Overflow overflow, Level keep);
+    void stop();
+    bool push(const Record& record); // false if not running
+    void flush();
+    size_t dropped() const;
+    size_t depth(); // lines pushed and not written yet
+    size_t highWater() const; // the deepest the queues were when the writer collected from them
+
+    enum {BatchSize = 64};
+
+private:
+    typedef std::shared_ptr<RecordRing> RingPtr;
+    typedef std::vector<RingPtr> RingList;
+    struct ThreadRing {
+        ThreadRing():ring() {}
+        ThreadRing(const ThreadRing&) = delete;
+        ThreadRing& operator=(const ThreadRing&) = delete;
+        ~ThreadRing() {if (ring) {ring->close();}}
+
+        RingPtr ring;
+    };
+    const Write _write;
+    RingList _rings; // must hold _ringsMutex
+    std::mutex _ringsMutex;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _written;
+    std::atomic<bool> _running;
+    std::atomic<bool> _sleeping;
+    std::atomic<size_t> _queueSize;
+    std::atomic<int> _overflow;
+    std::atomic<int> _keep;
+    std::atomic<size_t> _writtenCount;
+    std::atomic<size_t> _droppedCount;
+    std::atomic<size_t> _highWater;
+    size_t _retiredCount; // pushed to rings that have been removed, must hold _ringsMutex
+    bool _stopping;
+    static bool& _onWriterThread();
+    static uint64_t _now();
+    RecordRing& _threadRing();
+    size_t _pushed();
+    size_t _collect(std::vector<Record>& batch);
+    void _run();
+    void _notify();
+};
+
+/*
+    File of log lines recorded as the call site and the raw values streamed.
+    Each call site is described once per file and then referred to by id.
+    Values are in the native byte order, decode on a machine of the same architecture.
+*/
+class BinaryLog {
+public:
+    BinaryLog();
+    BinaryLog(const BinaryLog&) = delete;
+    BinaryLog& operator=(const BinaryLog&) = delete;
+    ~BinaryLog();
+
+    void open(const std::string& path); // empty path closes
+    bool active() const;
+    void write(const Logger& logger, size_t thread, const char* arguments, size_t size, bool pad);
+    void flush();
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    append(MessageBuffer& arguments, T value);
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+    append(MessageBuffer& arguments, T value);
+    static void append(MessageBuffer& arguments, float value);
+    static void append(MessageBuffer& arguments, double value);
+    static void append(MessageBuffer& arguments, long double value);
+    static void append(MessageBuffer& arguments, const void* pointer);
+    static void append(MessageBuffer& arguments, const char* text, size_t size);
+
+    enum Entry {SiteEntry = 'S', ThreadEntry = 'T', LineEntry = 'L'};
+    enum Argument {
+        SignedArgument = 'i', UnsignedArgument = 'u', FloatArgument = 'f', DoubleArgument = 'd',
+        LongDoubleArgument = 'D', PointerArgument = 'p', StringArgument = 's',
+    };
+    static const char* magic(); // the first bytes of the file
+    enum {MagicSize = 8, NoString = 0xFFFFFFFF};
+
+private:
+    struct ThreadName {
+        ThreadName():generation(0), name() {}
+
+        uint32_t generation;
+        std::string name;
+    };
+    std::mutex _mutex;
+    FILE* _file; // must hold _mutex
+    std::atomic<bool> _active;
+    uint32_t _generation; // bumped each time a file is opened, must hold _mutex
+    uint32_t _nextId; // must hold _mutex
+    std::string _entry; // must hold _mutex
+    template<typename T>
+    static void _append(MessageBuffer& arguments, char type, T value);
+    template<typename T>
+    void _put(T value);
+    void _putString(const char* text);
+    void _putSite(uint32_t id, const Logger& logger);
+};
+
+/*
+    Ring of the lines that were not shown, kept unformatted so recording a line costs about a copy.
+    Writers take an index with one atomic add and claim its slot by moving the slot's sequence number to odd,
+    so two writers a lap apart never write the same slot; the one that loses drops its line.
+    Everything in a slot is a relaxed atomic, and a slot overwritten while it is being read is skipped.
+    The text, then the context and kv fields, are kept up to lineBytes; longer text is cut short and fields that
+    do not fit are left out. Signals that do not crash the program are handed to a thread, so the dump is not done in the handler.
+*/
+class FlightRecorder {
+public:
+    typedef void (*Dump)();
+
+    explicit FlightRecorder(Dump dump);
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+    ~FlightRecorder();
+
+    void configure(size_t lines, Level level, size_t lineBytes); // must be serialized
+    bool wants(Level level) const;
+    void record(const Logger& logger, size_t thread, const char* line, size_t size);
+    size_t collect(std::vector<Record>& records, IFormatter& formatter); // formats and forgets what was recorded
+    void dumpOnSignal(int signal);
+
+private:
+    struct Slot {
+        Slot();
+
+        std::atomic<uint64_t> sequence; // 2 * (index + 1) once written, odd while being written
+        std::atomic<int> level;
+        std::atomic<size_t> textSize;
+        std::atomic<size_t> fieldsSize; // encoded as in yalo::Fields, after the text
+        std::atomic<size_t> thread;
+        std::atomic<int64_t> nanoseconds; // since the epoch
+        std::atomic<const char*> file; // call site strings are literals, so the pointers stay valid
+        std::atomic<int> line;
+        std::atomic<const char*> function;
+        std::atomic<const char*> condition;
+    };
+    struct Ring {
+        Ring(size_t lines, size_t bytes);
+
+        const size_t capacity;
+        const size_t lineBytes;
+        const size_t slotWords; // lineBytes in whole words
+        std::unique_ptr<Slot[]> slots;
+        std::unique_ptr<std::atomic<uint64_t>[]> words; // the text and fields of each slot
+        std::atomic<uint64_t> next;
+        uint64_t collected; // must hold _mutex
+    };
+    const Dump _dump;
+    std::atomic<int> _level; // -1 when off
+    std::atomic<Ring*> _ring;
+    std::vector<std::unique_ptr<Ring>> _rings; // every ring ever used, so a late writer never sees a freed one
+    std::mutex _mutex;
+    std::thread _thread;
+    int _pipe[2];
+    static std::atomic<int>& _signalPipe();
+    static void _signaled(int signal);
+    void _run();
+};
+
+/*
+    Calls a function every interval from its own thread until stopped or the program exits.
+*/
+class PeriodicTask {
+public:
+    typedef void (*Task)();
+
+    explicit PeriodicTask(Task task);
+    PeriodicTask(const PeriodicTask&) = delete;
+    PeriodicTask& operator=(const PeriodicTask&) = delete;
+    ~PeriodicTask();
+
+    void start(int intervalMilliseconds); // restarts with the new interval if already running
+    void stop();
+
+private:
+    const Task _task;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping; // must hold _mutex
+    void _run(int intervalMilliseconds);
+};
+
+/*
+    Background thread that applies a settings file whenever its contents change.
+*/
+class SettingsWatcher {
+public:
+    typedef void (*Apply)(const std::string& contents);
+    typedef std::string (*Read)(const std::string& path);
+
+    SettingsWatcher(Apply apply, Read read);
+    SettingsWatcher(const SettingsWatcher&) = delete;
+    SettingsWatcher& operator=(const SettingsWatcher&) = delete;
+    ~SettingsWatcher();
+
+    void watch(const std::string& path, int checkIntervalSeconds); // applies it now, empty path stops
+    uint64_t loads() const;
+
+    typedef std::system_error SystemError;
+
+private:
+    const Apply _apply;
+    const Read _read;
+    std::string _path;
+    std::string _lastContents; // only used by the watcher thread while it runs
+    std::thread _thread;
+    int _wake[2]; // self pipe to stop the thread
+    std::atomic<bool> _stopping;
+    std::atomic<uint64_t> _loads;
+    void _stop();
+    void _check();
+    void _run(int checkIntervalSeconds);
+    bool _woken(int timeoutMilliseconds, int events); // false when stopping
+    static std::string _directory(const std::string& path);
+};
+
+/*
+    Turns a BinaryLog file back into the text DefaultFormatter would have logged.
+*/
+class BinaryDecoder {
+public:
+    explicit BinaryDecoder(DefaultFormatter::Location location=DefaultFormatter::Local,
+                           DefaultFormatter::Precision precision=DefaultFormatter::Milliseconds);
+    ~BinaryDecoder()=default;
+
+    void decode(FILE* input, ISink& output);
+
+    typedef std::runtime_error RuntimeError;
+
+private:
+    struct Site {
+        Site():level(Log), line(0), file(), function(), condition(), hasFile(false), hasFunction(false),
+               hasCondition(false) {}
+
+        Level level;
+        int line;
+        std::string file;
+        std::string function;
+        std::string condition;
+        bool hasFile;
+        bool hasFunction;
+        bool hasCondition;
+    };
+    DefaultFormatter _formatter;
+    std::map<uint32_t, Site> _sites;
+    std::map<uint64_t, std::string> _threadNames;
+    static bool _read(FILE* input, void* data, size_t size, bool endAllowed=false);
+    template<typename T>
+    static T _get(FILE* input);
+    static bool _getString(FILE* input, std::string& text); // false if the string was null
+    template<typename T>
+    static T _argument(const std::string& arguments, size_t& offset);
+    static void _text(const std::string& arguments, bool pad, std::string& text);
+};
+    
+inline void ISink::logBatch(const Record* records, size_t count) {
+    for (size_t index = 0; index < count; ++index) {
+        log(records[index].line);
+    }
+}
+
+inline void IFormatter::formatInto(std::string& buffer, const char* line, size_t size, size_t thread, const Logger& logger) {
+    buffer.append(format(std::string(line, size), thread, logger));
+}
+
+inline void Logger::addSink(ISinkPtr method, Level level, SharedFormatter formatter) {
+    if (method) {
+        const SinkEntryPtr entry(new SinkEntry(std::move(method), level, std::move(formatter)));
+        Lock protection(_mutex(SinkListMutex));
+        auto sinks = _sinks().currentNeedsLock();
+
+        sinks.push_back(entry);
+        _publishSinksNeedsLock(std::move(sinks));
+    }
+}
+
+inline void Logger::clearSinks() {
+    Lock protection(_mutex(SinkListMutex));
+
+    _publishSinksNeedsLock(SinkList());
+}
+
+inline void Logger::setFormat(IFormatterPtr formatter) {
+    _formatter(std::move(formatter));
+}
+
+inline void Logger::setSettingsFile(const std::string& path, int checkIntervalSeconds) {
+    /*
+        The file is applied now (if it exists), and then by a background thread every time it changes.
+        Where the platform can't notify about changes (or the directory doesn't exist),
+        the file is checked every checkIntervalSeconds instead.
+    */
+    Lock lock(_mutex(SettingsMutex));
+
+    if (!path.empty()) {
+        Logger(Log)._logLineCore("New Settings File: " + path);
+    }
+
+    _settings().watch(path, checkIntervalSeconds);
+}
+
+inline uint64_t Logger::settingsLoads() {
+    return _settings().loads();
+}
+
+inline void Logger::setFlightRecorder(size_t lines, Level level, size_t lineBytes) {
+    Lock lock(_mutex(LevelsMutex));
+
+    _flightRecorder().configure(lines, level, lineBytes);
+    _generation().fetch_add(1); // call sites cache whether they record
+}
+
+inline void Logger::dumpFlightRecorder() {
+    std::vector<Record> records;
+    const Logger reporter(Log);
+
+    if (_flightRecorder().collect(records, *_formatter()) == 0) {
+        return;
+    }
+
+    records.insert(records.begin(), Record(Log, _formatter()->format(
+                       "Flight recorder: " + std::to_string(records.size()) + " lines that were not shown",
+                       _threadIndex(), reporter)));
+    records.push_back(Record(Log, _formatter()->format("Flight recorder: end", _threadIndex(), reporter)));
+    _async().flush(); // what was already queued came first
+    _writeRecords(records.data(), records.size());
+}
+
+inline void Logger::dumpFlightRecorderOnSignal(int signal) {
+    if (SIGSEGV == signal || SIGBUS == signal || SIGFPE == signal || SIGILL == signal || SIGABRT == signal) {
+        _flightRecorder(); // the handler must not be the first to construct it
+        ::signal(signal, _crashed);
+    } else {
+        _flightRecorder().dumpOnSignal(signal);
+    }
+}
+
+inline Stats Logger::stats() {
+    Stats current;
+
+    current.filtered = ThreadCounters::total(ThreadCounters::Filtered);
+    current.requested = ThreadCounters::total(ThreadCounters::Shown) + current.filtered;
+    current.emitted = ThreadCounters::total(ThreadCounters::Emitted);
+    current.bytes = ThreadCounters::total(ThreadCounters::Bytes);
+    current.dropped = _async().dropped();
+    current.failedSinks = _failedSinks().load(std::memory_order_relaxed);
+    current.settingsLoads = settingsLoads();
+    current.queueDepth = _async().depth();
+    current.queueHighWater = _async().highWater();
+
+    const Snapshot<SinkList>::Reader sinks(_sinks());
+
+    for (const auto& entry : *sinks) {
+        SinkStats sink;
+
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wpotentially-evaluated-expression"
+        sink.sink = entry->sink ? typeid(*entry->sink).name() : "";
+        #pragma GCC diagnostic pop
+        sink.batches = entry->batches.load(std::memory_order_relaxed);
+        sink.lines = entry->lines.load(std::memory_order_relaxed);
+        sink.bytes = entry->bytes.load(std::memory_order_relaxed);
+
+        for (size_t bucket = 0; bucket < SinkStats::LatencyBuckets; ++bucket) {
+            sink.latency[bucket] = entry->latency[bucket].load(std::memory_order_relaxed);
+        }
+
+        current.sinks.push_back(sink);
+    }
+
+    return current;
+}
+
+inline void Logger::setStatsReport(int intervalSeconds, StatsHook hook) {
+    _statsHook().store(hook);
+
+    if (intervalSeconds > 0) {
+        _statsReporter().start(intervalSeconds * 1000);
+    } else {
+        _statsReporter().stop();
+    }
+}
+
+inline void Logger::setLevel(Level level, const std::string& pattern) {
+    /*
+        If you set Error, "" then all files will be shown for Error or Log
+        Any levels higher than Error and have "" set, will be cleared.
+        To clear, the higher levels *must* match the pattern exactly
+    */
+    Lock lock(_mutex(LevelsMutex));
+    auto levels = _levels().currentNeedsLock();
+    const auto start = static_cast<int>(level);
+    const auto max = static_cast<int>(Trace);
+
+    levels[level] = FilePattern(pattern);
+
+    for (int index = start; index <= max; ++index) {
+        const auto lvl = static_cast<Level>(index);
+
+        if (pattern == levels[lvl].pattern()) {
+            levels.erase(lvl);
+        }
+    }
+
+    _publishLevelsNeedsLock(levels);
+}
+
+inline void Logger::resetLevels(Level level) {
+    Lock lock(_mutex(LevelsMutex));
+    FileLevels levels;
+
+    levels[level] = FilePattern();
+    _publishLevelsNeedsLock(levels);
+}
+
+inline bool Logger::shown(Level loggedLevel, const std::string& file) {
+    return shown(loggedLevel, file.c_str());
+}
+
+inline bool Logger::shown(Level loggedLevel, const char* file) {
+    /*
+        If the file has been set to the requested loggedLevel or higher,
+        it can be logged.
+    */
+    const Snapshot<FileLevels>::Reader reader(_levels());
+    const auto& levels = *reader;
+    const auto start = static_cast<int>(loggedLevel);
+    const auto max = static_cast<int>(Trace);
+
+    for (int index = start; index <= max; ++index) {
+        const auto level = static_cast<Level>(index);
+        const auto found = levels.find(level);
+
+        if (found == levels.end()) {
+            continue; // nothing authorized for this level
+        }
+
+        if (found->second.matches(nullptr == file ? "" : file)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void Logger::setInserterSpacing(InserterSpacing spacing) {
+    _spacing(spacing);
+}
+
+inline void Logger::setAsynchronous(size_t queueSize, Overflow overflow, Level keep) {
+    /*
+        Formatted lines are queued and written to the sinks by a background thread.
+        Each logging thread has its own queue of queueSize lines, so threads do not
+        contend with each other. A change in queueSize applies to threads that have
+        not logged asynchronously yet.
+        When the queue is full:
+        - OverflowBlock waits for room
+        - OverflowDropNewest drops the line
+        - OverflowDropBelowLevel drops lines less important than keep and waits for the rest
+        Fatal lines are always written synchronously after everything queued.
+    */
+    _async().start(queueSize, overflow, keep);
+}
+
+inline void Logger::setSynchronous() {
+    _async().stop();
+}
+
+inline void Logger::flush() {
+    _async().flush();
+    _binaryLog().flush();
+}
+
+inline void Logger::setThreadName(const std::string& name) {
+    /*
+        The name is logged instead of the thread index for lines logged by this thread.
+        An empty name goes back to the index.
+    */
+    _threadNameStorage() = name;
+}
+
+inline const std::string& Logger::threadName() {
+    return _threadNameStorage();
+}
+
+inline void Logger::setBinaryLog(const std::string& path) {
+    /*
+        Lines are recorded to path as the call site and the raw values streamed,
+        without formatting any text. BinaryDecoder (or yalo_decode) turns the file into text.
+        Fatal lines are still formatted and sent to the sinks.
+        An empty path closes the file and goes back to text.
+    */
+    _binaryLog().open(path);
+}
+
+inline void Logger::setTraceMode(TraceMode mode, uint64_t sampleEvery) {
+    /*
+        TraceLines logs every traced if, while, and switch while Trace is shown for the file.
+        TraceCounters counts how often each one is taken and not taken instead,
+        and when sampleEvery is not 0 only logs one of every sampleEvery evaluations of each.
+    */
+    TraceSite::_sampleEvery().store(sampleEvery);
+    TraceSite::_mode().store(mode);
+}
+
+inline void Logger::setSuppressedSummary(bool summarize) {
+    /*
+        When on (the default), a rate limited line that is logged starts with
+        "(suppressed N repeats)" if lines from its site were suppressed since the last one.
+    */
+    RateLimitedSite::_summaries().store(summarize);
+}
+
+inline Logger::TraceCounts Logger::traceCounts() {
+    TraceCounts counts;
+
+    for (auto site = TraceSite::first(); nullptr != site; site = site->next()) {
+        const auto& callsite = site->_callsite;
+
+        counts.push_back(TraceCount {site->flow, site->expression, callsite.file, callsite.line,
+                                     callsite.function, site->taken(), site->notTaken()});
+    }
+
+    return counts;
+}
+
+inline void Logger::logTraceCounts() {
+    for (const auto& count : traceCounts()) {
+        if (0 == count.taken && 0 == count.notTaken) {
+            continue;
+        }
+
+        auto text = std::string("Trace ") + count.file + ":" + std::to_string(count.line)
+                    + " " + count.function + " " + count.flow + ": " + count.expression;
+
+        text += ::strcmp(count.flow, "switch") == 0
+                ? " evaluated " + std::to_string(count.taken)
+                : " true " + std::to_string(count.taken) + " false " + std::to_string(count.notTaken);
+        Logger(Log)._logLineCore(text);
+    }
+}
+
+inline Logger::TimingSummaries Logger::takeTimings() {
+    TimingSummaries summaries;
+
+    for (auto site = TimingSite::first(); nullptr != site; site = site->next()) {
+        const auto summary = site->take();
+
+        if (summary.count > 0) {
+            summaries.push_back(summary);
+        }
+    }
+
+    return summaries;
+}
+
+inline void Logger::logTimings() {
+    for (const auto& summary : takeTimings()) {
+        const auto text = std::string("Timing ") + summary.name + ": count " + std::to_string(summary.count)
+                        + " min " + _duration(summary.min) + " p50 " + _duration(summary.p50)
+                        + " p99 " + _duration(summary.p99) + " max " + _duration(summary.max);
+
+        Logger(summary.level, summary.file, summary.line, summary.function).log_line(text);
+    }
+}
+
+inline void Logger::setTimingReport(int intervalSeconds) {
+    if (intervalSeconds > 0) {
+        _timingReporter().start(intervalSeconds * 1000);
+    } else {
+        _timingReporter().stop();
+    }
+}
+
+inline PeriodicTask& Logger::_timingReporter() {
+    _async(); // the sinks and formatter must outlive the reporting thread
+    TimingSite::first();
+    static PeriodicTask reporter(logTimings);
+
+    return reporter;
+}
+
+inline std::string Logger::_duration(uint64_t nanoseconds) {
+    char text[Number::BufferSize];
+
+    if (nanoseconds < 1000) {
+        return std::to_string(nanoseconds) + "ns";
+    }
+
+    const auto value = static_cast<double>(nanoseconds);
+
+    if (nanoseconds < 1000000) {
+        ::snprintf(text, sizeof(text), "%.1fus", value / 1e3);
+    } else if (nanoseconds < 1000000000) {
+        ::snprintf(text, sizeof(text), "%.1fms", value / 1e6);
+    } else {
+        ::snprintf(text, sizeof(text), "%.2fs", value / 1e9);
+    }
+
+    return text;
+}
+
+inline Logger::Logger(Level level, const char* fl, const int ln, const char* func, bool doLog, const char* cond)
+    :levelRequested(level), file(fl), line(ln), function(func), condition(cond), callsite(nullptr),
+     _stream(), _fields(), _doLog(doLog), _binary(doLog && Fatal != level && _binaryLog().active()) {}
+
+inline Logger::Logger(const CallSite& site, bool doLog)
+    :levelRequested(site.level), file(site.file), line(site.line), function(site.function),
+     condition(site.condition), callsite(&site), _stream(), _fields(), _doLog(doLog),
+     _binary(doLog && Fatal != site.level && _binaryLog().active()) {}
+
+inline Logger::Logger(const RateLimitedSite& site)
+    :Logger(static_cast<const CallSite&>(site)) {
+    const auto summary = site.suppressedSummary();
+    auto size = ::strlen(summary);
+
+    if (0 == size) {
+        return;
+    }
+
+    if (InserterPad == _spacing(InserterPad, NoChange)) {
+        size -= 1; // the next insertion pads
+    }
+
+    if (_binary) {
+        BinaryLog::append(_stream, summary, size);
+    } else {
+        _stream.append(summary, size);
+    }
+}
+
+inline Logger::~Logger() {
+    if (levelRequested != Fatal && (!_doLog || (_stream.empty() && _fields.empty()))) {
+        return;
+    }
+
+    try {
+        if (_binary) {
+            _logBinary();
+        } else {
+            _logLine(_stream.data(), _stream.size());
+        }
+    } catch(...) {
+        // too late
+    }
+
+    if (_doLog && levelRequested == Fatal) {
+        ::abort();
+    }
+}
+
+inline Logger& Logger::log_line(const std::string& logLine) {
+    if (_binary) {
+        _stream.clear();
+        BinaryLog::append(_stream, logLine.data(), logLine.size());
+        return _logBinary();
+    }
+
+    return _logLine(logLine.data(), logLine.size());
+}
+
+inline bool Logger::_enabled() {
+    if (nullptr != callsite) {
+        return callsite->_shown(); // already counted when the statement checked enabled()
+    }
+
+    const auto show = _wanted(levelRequested, file);
+
+    ThreadCounters::add(show ? ThreadCounters::Shown : ThreadCounters::Filtered);
+    return show;
+}
+
+inline bool Logger::_recorded() {
+    if (nullptr != callsite) {
+        return 0 != (callsite->_levelState() & CallSite::Recorded);
+    }
+
+    return _flightRecorder().wants(levelRequested);
+}
+
+inline Logger& Logger::_logLine(const char* logLine, size_t size) {
+    if (!_enabled()) {
+        if (_recorded()) {
+            _flightRecorder().record(*this, _threadIndex(), logLine, size);
+        }
+
+        return *this;
+    }
+
+    return _logLineCore(logLine, size);
+}
+
+inline Logger& Logger::_logBinary() {
+    if (_enabled()) {
+        ThreadCounters::add(ThreadCounters::Emitted);
+        ThreadCounters::add(ThreadCounters::Bytes, _stream.size());
+        _binaryLog().write(*this, _threadIndex(), _stream.data(), _stream.size(),
+                           InserterPad == _spacing(InserterPad, NoChange));
+    }
+
+    return *this;
+}
+
+template<typename T>
+inline T Logger::logExpression(const std::string& flow, const std::string& expression, T result) {
+    log_line(flow + ": " + expression + " => " + std::to_string(result));
+    return result;
+}
+
+inline bool Logger::logExpressionBool(const std::string& flow, const std::string& expression, bool result) {
+    log_line(flow + ": " + expression + " => " + (result ? "true" : "false"));
+    return result;
+}
+
+template<typename T, typename>
+inline Logger& Logger::operator<<(T value) {
+    char text[Number::BufferSize];
+
+    if (_binary) {
+        BinaryLog::append(_stream, value);
+        return *this;
+    }
+
+    return _append(text, Number::write(text, value));
+}
+
+inline Logger& Logger::operator<<(const std::string& str) {
+    if (_binary) {
+        BinaryLog::append(_stream, str.data(), str.size());
+        return *this;
+    }
+
+    return _append(str.data(), str.size());
+}
+
+inline Logger& Logger::operator<<(const char* str) {
+    if (_binary) {
+        BinaryLog::append(_stream, str, ::strlen(str));
+        return *this;
+    }
+
+    return _append(str, ::strlen(str));
+}
+
+inline Logger& Logger::operator<<(const void* ptr) {
+    char text[Number::BufferSize];
+
+    if (_binary) {
+        BinaryLog::append(_stream, ptr);
+        return *this;
+    }
+
+    return _append(text, Number::write(text, ptr));
+}
+
+inline Logger& Logger::operator<<(float value) {
+    char text[Number::BufferSize];
+
+    if (_binary) {
+        BinaryLog::append(_stream, value);
+        return *this;
+    }
+
+    return _append(text, Number::write(text, value));
+}
+
+inline Logger& Logger::operator<<(double value) {
+    char text[Number::BufferSize];
+
+    if (_binary) {
+        BinaryLog::append(_stream, value);
+        return *this;
+    }
+
+    return _append(text, Number::write(text, value));
+}
+
+inline Logger& Logger::operator<<(const std::exception& exception) {
+    return (*this) << _formatter()->format(exception);
+}
+
+inline Logger& Logger::operator<<(const KeyValue& field) {
+    if (_binary) { // the binary log has no fields, so the pair becomes text
+        std::string text(field.key, field.keySize);
+
+        text.append(1, '=');
+        text.append(field.value(), field.valueSize());
+        BinaryLog::append(_stream, text.data(), text.size());
+        return *this;
+    }
+
+    Fields::append(_fields, field);
+    return *this;
+}
+
+inline Fields Logger::fields() const {
+    return Fields(_fields.data(), _fields.size());
+}
+
+inline std::mutex& Logger::_mutex(Mutex mutexType) {
+    static std::mutex sinkList;
+    static std::mutex formatterMutex;
+    static std::mutex levelsMutex;
+    static std::mutex settingsMutex;
+
+    switch(mutexType) {
+        case SinkListMutex:
+            return sinkList;
+        case FormatterMutex:
+            return formatterMutex;
+        case LevelsMutex:
+            return levelsMutex;
+        case SettingsMutex:
+            return settingsMutex;
+        default:
+            throw std::invalid_argument("mutexType is invalid: " 
+                + std::to_string(static_cast<int>(mutexType)));
+    }
+}
+
+inline std::atomic<uint32_t>& Logger::_generation() {
+    static std::atomic<uint32_t> generation(1);
+
+    return generation;
+}
+
+inline size_t Logger::_threadIndex() {
+    static std::atomic<size_t> nextIndex(0);
+    static thread_local const size_t index = nextIndex.fetch_add(1);
+
+    return index;
+}
+
+inline std::string& Logger::_threadNameStorage() {
+    static thread_local std::string name;
+
+    return name;
+}
+
+inline Snapshot<Logger::FileLevels>& Logger::_levels() {
+    static Snapshot<FileLevels> levels(Snapshot<FileLevels>::Ptr(new FileLevels {{Error, FilePattern()}}));
+
+    return levels;
+}
+
+inline void Logger::_publishLevelsNeedsLock(FileLevels& levels) {
+    if (levels.size() == 0) {
+        levels[Error] = FilePattern();
+    }
+
+    _levels().publishNeedsLock(Snapshot<FileLevels>::Ptr(new FileLevels(std::move(levels))));
+    _generation().fetch_add(1);
+}
+
+inline Logger::SinkEntry::SinkEntry(ISinkPtr method, Level most, SharedFormatter format)
+    :sink(std::move(method)), level(most), formatter(std::move(format)), mutex(), batches(0), lines(0), bytes(0), latency(),
+     writer(std::thread::id()) {
+    for (auto& bucket : latency) {
+        bucket.store(0);
+    }
+}
+
+inline Logger::HoldSink::HoldSink(SinkEntry& entry)
+    :_entry(entry), _lock(entry.mutex) {
+    _entry.writer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+}
+
+inline Logger::HoldSink::~HoldSink() {
+    _entry.writer.store(std::thread::id(), std::memory_order_relaxed);
+}
+
+inline bool Logger::HoldSink::heldByThisThread(const SinkEntry& entry) {
+    // only this thread stores its own id, so the answer is exact for this thread
+    return entry.writer.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+inline Logger::Nesting::Nesting(int& depth)
+    :_depth(depth) {
+    ++_depth;
+}
+
+inline Logger::Nesting::~Nesting() {
+    --_depth;
+}
+
+inline bool Logger::Nesting::outermost() const {
+    return 1 == _depth;
+}
+
+inline bool Logger::Nesting::tooDeep() const {
+    return _depth > MaxDepth;
+}
+
+inline Snapshot<Logger::SinkList>& Logger::_sinks() {
+    static Snapshot<SinkList> sinks(Snapshot<SinkList>::Ptr(new SinkList()));
+
+    return sinks;
+}
+
+inline void Logger::_publishSinksNeedsLock(SinkList sinks) {
+    /*
+        Sinks removed here are destroyed by whichever thread drops the last reference,
+        which may be a logger that was still writing to them.
+    */
+    int level = sinks.empty() ? Trace : Fatal; // with no sinks, lines go to stderr
+
+    for (const auto& entry : sinks) {
+        level = std::max<int>(level, entry->level);
+    }
+
+    _sinks().publishNeedsLock(Snapshot<SinkList>::Ptr(new SinkList(std::move(sinks))));
+    _sinkLevel().store(level);
+    _generation().fetch_add(1); // call sites cache whether any sink takes their level
+}
+
+inline std::atomic<int>& Logger::_sinkLevel() {
+    static std::atomic<int> level(Trace);
+
+    return level;
+}
+
+inline bool Logger::_wanted(Level level, const char* fileName) {
+    return static_cast<int>(level) <= _sinkLevel().load(std::memory_order_relaxed) && shown(level, fileName);
+}
+
+inline Logger& Logger::_append(const char* value, size_t size) {
+    if (InserterPad == _spacing(InserterPad, NoChange) && !_stream.empty()) {
+        _stream.append(' ');
+    }
+
+    _stream.append(value, size);
+    return *this;
+}
+
+inline AsyncWriter& Logger::_async() {
+    _sinks(); // sinks, formatter, and counters must outlive the writer thread
+    ThreadCounters::total(ThreadCounters::Emitted);
+    _formatter();
+    static AsyncWriter writer(_writeRecords);
+
+    return writer;
+}
+
+inline BinaryLog& Logger::_binaryLog() {
+    static BinaryLog binaryLog;
+
+    return binaryLog;
+}
+
+inline Logger& Logger::_logLineCore(const std::string& logLine) {
+    return _logLineCore(logLine.data(), logLine.size());
+}
+
+inline Logger& Logger::_logLineCore(const char* logLine, size_t size) {
+    static thread_local int depth = 0;
+    static thread_local Record reused; // so steady state logging does not allocate
+    const Nesting nesting(depth);
+    Record nested; // a sink or formatter logging must not overwrite the line being written
+
+    if (nesting.tooDeep()) {
+        return *this;
+    }
+
+    auto& record = nesting.outermost() ? reused : nested;
+    size_t formatted = 0;
+    size_t bytes = 0;
+
+    record.level = levelRequested;
+    record.line.clear();
+
+    /*
+        Each formatter formats the line once, however many sinks use it,
+        and not at all when none of its sinks take this level.
+    */
+    {
+        const Snapshot<SinkList>::Reader sinks(_sinks());
+        bool logger = sinks->empty();
+
+        for (const auto& entry : *sinks) {
+            if (levelRequested > entry->level) {
+                continue;
+            }
+
+            if (!entry->formatter) {
+                logger = true;
+                continue;
+            }
+
+            size_t index = 0;
+
+            while (index < formatted && record.formatted[index].first != entry->formatter.get()) {
+                ++index;
+            }
+
+            if (index < formatted) {
+                continue;
+            }
+
+            if (formatted == record.formatted.size()) {
+                record.formatted.push_back(Record::Formatted());
+            }
+
+            auto& text = record.formatted[formatted++];
+
+            text.first = entry->formatter.get();
+            text.second.clear();
+            entry->formatter->formatInto(text.second, logLine, size, _threadIndex(), *this);
+            bytes += text.second.size();
+        }
+
+        record.formatted.resize(formatted); // drops the formatters no sink took this line for
+
+        if (logger) {
+            _formatter()->formatInto(record.line, logLine, size, _threadIndex(), *this);
+            bytes += record.line.size();
+        }
+    }
+
+    if (record.line.empty() && 0 == formatted) {
+        return *this; // the sinks changed since the level was checked
+    }
+
+    ThreadCounters::add(ThreadCounters::Emitted);
+    ThreadCounters::add(ThreadCounters::Bytes, bytes);
+
+    if (Fatal != levelRequested && _async().push(record)) {
+        return *this;
+    }
+
+    if (Fatal == levelRequested) {
+        _async().flush(); // everything before the fatal line must be written before we abort
+        _binaryLog().flush();
+        dumpFlightRecorder();
+    }
+
+    _writeRecords(&record, 1);
+    return *this;
+}
+
+inline const Record* Logger::_sinkBatch(const SinkEntry& entry, const Record* records, size_t& count,
+                                        std::vector<Record>& batch) {
+    // the records this sink takes, with the line its formatter wrote
+    size_t taken = 0;
+
+    for (size_t index = 0; index < count; ++index) {
+        const auto& record = records[index];
+        const std::string* line = entry.formatter ? nullptr : &record.line;
+
+        if (record.level > entry.level) {
+            continue;
+        }
+
+        if (entry.formatter) {
+            for (const auto& formatted : record.formatted) {
+                if (formatted.first == entry.formatter.get()) {
+                    line = &formatted.second;
+                }
+            }
+        }
+
+        if (nullptr == line || line->empty()) {
+            continue; // formatted before this sink was added, so not in its format
+        }
+
+        if (taken == batch.size()) {
+            batch.push_back(Record());
+        }
+
+        batch[taken].level = record.level;
+        batch[taken].timestamp = record.timestamp;
+        batch[taken].line.assign(*line);
+        ++taken;
+    }
+
+    count = taken;
+    return batch.data();
+}
+
+inline void Logger::_writeRecords(const Record* records, size_t count) {
+    static thread_local int depth = 0;
+    static thread_local std::vector<Record> reused; // batches keep their strings' capacity from call to call
+    const Nesting nesting(depth);
+    std::vector<Record> nested;
+    auto& batches = nesting.outermost() ? reused : nested;
+    typedef std::pair<std::string, std::string> ExceptionLogger;
+    typedef std::vector<ExceptionLogger> ExceptionList;
+    ExceptionList failed_sinks;
+    SinkList failed;
+    bool empty = false;
+
+    /*
+        The sink list is only read here, so adding or clearing sinks never waits on a slow sink.
+        Each sink is locked on its own while it writes.
+    */
+    {
+        const Snapshot<SinkList>::Reader sinks(_sinks());
+
+        empty = count > 0 && sinks->empty(); // an idle tick after clearSinks() has nothing to fall back for
+
+        bool complete = true; // every record has the logger's format
+        int verbose = Fatal;
+
+        for (size_t index = 0; index < count; ++index) {
+            complete = complete && !records[index].line.empty();
+            verbose = std::max<int>(verbose, records[index].level);
+        }
+
+        for (const auto& entry : *sinks) {
+            if (HoldSink::heldByThisThread(*entry)) {
+                continue; // logged from inside this sink
+            }
+
+            try {
+                const HoldSink protection(*entry);
+                size_t written = count;
+                const auto batch = !entry->formatter && complete && verbose <= entry->level
+                                 ? records : _sinkBatch(*entry, records, written, batches);
+                // reading the clock costs about as much as a fast sink, so only some writes are timed
+                const auto timed = written > 0
+                                && entry->batches.load(std::memory_order_relaxed) % SinkStats::LatencySampleEvery == 0;
+                const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+                if (written > 0 || 0 == count) {
+                    entry->sink->logBatch(batch, written);
+                }
+
+                if (timed) {
+                    const auto elapsed = std::chrono::steady_clock::now() - start;
+                    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+                    size_t bucket = 0;
+
+                    while (bucket + 1 < SinkStats::LatencyBuckets && (int64_t(1) << bucket) <= micros) {
+                        ++bucket;
+                    }
+
+                    _addHeld(entry->latency[bucket], 1);
+                }
+
+                if (written > 0) {
+                    uint64_t bytes = 0;
+
+                    for (size_t index = 0; index < written; ++index) {
+                        bytes += batch[index].line.size();
+                    }
+
+                    _addHeld(entry->batches, 1);
+                    _addHeld(entry->lines, written);
+                    _addHeld(entry->bytes, bytes);
+                }
+            } catch (const std::exception& exception) {
+                #pragma GCC diagnostic push
+                #pragma GCC diagnostic ignored "-Wpotentially-evaluated-expression"
+                const auto loggerType = entry->sink ? typeid(*entry->sink).name() : "";
+                #pragma GCC diagnostic pop
+
+                failed_sinks.push_back(ExceptionLogger(_formatter()->format(exception), loggerType));
+                failed.push_back(entry);
+                _failedSinks().fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    if (empty || !failed.empty()) {
+        Lock protection(_mutex(SinkListMutex));
+        SinkList survivors;
+
+        for (const auto& entry : _sinks().currentNeedsLock()) {
+            if (std::find(failed.begin(), failed.end(), entry) == failed.end()) {
+                survivors.push_back(entry);
+            }
+        }
+
+        if (survivors.empty()) {
+            survivors.push_back(SinkEntryPtr(new SinkEntry(std::unique_ptr<StdErrSink>(new StdErrSink()))));
+        }
+
+        _publishSinksNeedsLock(std::move(survivors));
+    }
+
+    if (empty) {
+        _writeRecords(records, count); // logged to the stderr sink we just added
+    }
+
+    if (!failed_sinks.empty()) {
+        const Logger reporter(Log);
+        const Snapshot<SinkList>::Reader sinks(_sinks());
+
+        for (const auto& exceptionLogger : failed_sinks) {
+            for (const auto& entry : *sinks) {
+                try {
+                    const auto line = _formatter()->format("Logger[" + exceptionLogger.second + "]: " 
+                                                            + exceptionLogger.first, 
+                                                            _threadIndex(), reporter);
+                    if (HoldSink::heldByThisThread(*entry)) {
+                        continue;
+                    }
+
+                    const HoldSink protection(*entry);
+
+                    entry->sink->log(line);
+                } catch(const std::exception&) {
+                    // we tried
+                }
+            }
+        }
+    }
+}
+
+inline Logger::IFormatterPtr& Logger::_formatter(IFormatterPtr update) {
+    static IFormatterPtr formatter;
+    Lock protection(_mutex(FormatterMutex));
+
+    if (update) {
+        formatter = std::move(update);
+    } else if (!formatter) {
+        formatter = std::unique_ptr<DefaultFormatter>(new DefaultFormatter());
+    }
+
+    return formatter;
+}
+
+inline Logger::IFormatterPtr& Logger::_formatter() {
+    return _formatter(nullptr);
+}
+
+inline Logger::InserterSpacing Logger::_spacing(InserterSpacing next, Action action) {
+    static std::atomic<int> spacing(InserterPad); // the settings file can change it from its own thread
+
+    if (Change == action) {
+        spacing.store(next, std::memory_order_relaxed);
+    }
+
+    return static_cast<InserterSpacing>(spacing.load(std::memory_order_relaxed));
+}
+
+inline PeriodicTask& Logger::_statsReporter() {
+    _settings(); // everything stats() reads must outlive the reporting thread
+    _sinks();
+    _statsHook();
+    _failedSinks();
+    static PeriodicTask reporter(_reportStats);
+
+    return reporter;
+}
+
+inline std::atomic<Logger::StatsHook>& Logger::_statsHook() {
+    static std::atomic<StatsHook> hook(nullptr);
+
+    return hook;
+}
+
+inline std::atomic<uint64_t>& Logger::_failedSinks() {
+    static std::atomic<uint64_t> failed(0);
+
+    return failed;
+}
+
+inline FlightRecorder& Logger::_flightRecorder() {
+    _async(); // dumping writes to the sinks, which must outlive the signal thread
+    static FlightRecorder recorder(dumpFlightRecorder);
+
+    return recorder;
+}
+
+inline void Logger::_crashed(int signal) {
+    /*
+        Formatting and writing are not safe in a signal handler,
+        but the program is about to die, so this is the last chance to see why.
+    */
+    static std::atomic<bool> dumping(false);
+
+    if (!dumping.exchange(true)) {
+        try {
+            dumpFlightRecorder();
+        } catch(...) {
+            // crashing anyway
+        }
+    }
+
+    ::signal(signal, SIG_DFL);
+    ::raise(signal);
+}
+
+inline void Logger::_addHeld(std::atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline void Logger::_reportStats() {
+    const auto hook = _statsHook().load();
+    const auto current = stats();
+
+    if (nullptr != hook) {
+        hook(current);
+        return;
+    }
+
+    std::string text = "Logger stats: requested " + std::to_string(current.requested)
+                     + " filtered " + std::to_string(current.filtered)
+                     + " emitted " + std::to_string(current.emitted)
+                     + " bytes " + std::to_string(current.bytes)
+                     + " dropped " + std::to_string(current.dropped)
+                     + " failedSinks " + std::to_string(current.failedSinks)
+                     + " settingsLoads " + std::to_string(current.settingsLoads)
+                     + " queueDepth " + std::to_string(current.queueDepth)
+                     + " queueHighWater " + std::to_string(current.queueHighWater);
+
+    for (const auto& sink : current.sinks) {
+        text += "; " + sink.sink + ": lines " + std::to_string(sink.lines)
+              + " bytes " + std::to_string(sink.bytes)
+              + " p50 < " + std::to_string(sink.latencyPercentile(0.50)) + "us"
+              + " p99 < " + std::to_string(sink.latencyPercentile(0.99)) + "us";
+    }
+
+    Logger(Log)._logLineCore(text);
+}
+
+inline SettingsWatcher& Logger::_settings() {
+    _async(); // everything applying settings uses must outlive the watcher thread
+    _levels();
+    static SettingsWatcher watcher(_applySettings, _readFile);
+
+    return watcher;
+}
+
+inline void Logger::_applySettings(const std::string& contents) {
+    size_t start = 0;
+
+    while (start < contents.size()) {
+        const auto eol = contents.find('\n', start);
+        const auto line = _trim(contents.substr(start, eol - start));
+        const auto eoc = line.find(':');
+        const auto command = eoc == std::string::npos ? line : _trim(line.substr(0, eoc));
+        const auto data = eoc < line.size() ? _trim(line.substr(eoc + 1)) : std::string();
+        
+        if (line.empty()) {
+            // ignore empty lines
+        } else if (command == "clearSinks") {
+            Logger(Log)._logLineCore("Clearing Sinks");
+            clearSinks();
+        } else if (command == "setFormatDefault") {
+            setFormat(std::unique_ptr<DefaultFormatter>(new DefaultFormatter()));
+            Logger(Log)._logLineCore("Resetting format to default");
+        } else if (command == "setFormatDefaultGMT") {
+            setFormat(std::unique_ptr<DefaultFormatter>(new DefaultFormatter(DefaultFormatter::GMT)));
+            Logger(Log)._logLineCore("Resetting format to default GMT");
+        } else if (command == "setFormatJson") {
+            setFormat(std::unique_ptr<StructuredFormatter>(new StructuredFormatter(StructuredFormatter::Json)));
+            Logger(Log)._logLineCore("Setting format to JSON");
+        } else if (command == "setFormatLogfmt") {
+            setFormat(std::unique_ptr<StructuredFormatter>(new StructuredFormatter(StructuredFormatter::Logfmt)));
+            Logger(Log)._logLineCore("Setting format to logfmt");
+        } else if (command == "addSinkStdErr") {
+            addSink(std::unique_ptr<StdErrSink>(new StdErrSink()));
+            Logger(Log)._logLineCore("Adding stderr sink");
+        } else if (command == "addSinkStdOut") {
+            addSink(std::unique_ptr<StdOutSink>(new StdOutSink()));
+            Logger(Log)._logLineCore("Adding stdout sink");
+        } else if (command == "addSink") {
+            if (!data.empty()) {
+                try {
+                    if (NetworkSink::isUrl(data)) {
+                        addSink(std::unique_ptr<NetworkSink>(new NetworkSink(data)));
+                    } else {
+                        addSink(std::unique_ptr<FileSink>(new FileSink(data)));
+                    }
+                    Logger(Log)._logLineCore("Adding sink to " + data);
+                } catch(const std::exception& exception) {
+                    Logger(Log)._logLineCore("Error adding sink to " + data 
+                                                + ": " + exception.what());
+                }
+            } else {
+                Logger(Log)._logLineCore("Failed to add sink: " + line);
+            }
+        } else if (command == "addRotatingSink") {
+            const auto space = data.find_first_of(" \t");
+            const auto path = data.substr(0, space);
+            const auto options = space == std::string::npos ? std::string() : data.substr(space + 1);
+
+            try {
+                addSink(std::unique_ptr<RotatingFileSink>(
+                            new RotatingFileSink(path, RotatingFileSink::policy(options))));
+                Logger(Log)._logLineCore("Adding rotating sink to " + path);
+            } catch(const std::exception& exception) {
+                Logger(Log)._logLineCore("Error adding rotating sink to " + data
+                                            + ": " + exception.what());
+            }
+        } else if (command == "resetLevels") {
+            resetLevels(_fromString(data));
+            Logger(Log)._logLineCore("resetLevels to " + std::to_string(_fromString(data)));
+        } else if (command == "pad") {
+            setInserterSpacing(InserterPad);
+            Logger(Log)._logLineCore("Turned padding on");
+        } else if (command == "noPad") {
+            setInserterSpacing(InserterAsIs);
+            Logger(Log)._logLineCore("Turned padding off");
+        } else if (command == "setLevel") {
+            const auto equals = data.find('=');
+            const auto level = _fromString(data.substr(0, equals));
+            const auto pattern = equals < data.size() 
+                                    ? _trim(data.substr(equals+1)) 
+                                    : std::string();
+
+            setLevel(level, pattern);
+            Logger(Log)._logLineCore("Set level #" + std::to_string(level) 
+                                  + " pattern = '" + pattern + "'");
+        } else {
+            Logger(Log)._logLineCore("Unknown command '" + command + "': " + line);
+        }
+
+        start = eol < contents.size() ? eol + 1 : eol;
+    }
+
+    _generation().fetch_add(1);
+}
+
+inline std::string Logger::_readFile(const std::string& path) {
+    std::string buffer;
+
+    const auto file = ::fopen(path.c_str(), "r");
+
+    if (nullptr == file) {
+        return "";
+    }
+
+    ::fseek(file, 0, SEEK_END);
+    const size_t fileSize = static_cast<size_t>(::ftell(file));
+    ::rewind(file);
+    buffer.assign(fileSize, '\0');
+    const auto bytesRead = ::fread(&buffer[0], 1, fileSize, file);
+    ::fclose(file);
+    return bytesRead == fileSize ? buffer : std::string();
+}
+
+inline Level Logger::_fromString(const std::string &level) {
+    if (level.empty()) {
+        return Error;
+    }
+
+    switch(level[0]) {
+        case 'l':
+        case 'L':
+            return Log;
+        case 'E':
+        case 'e':
+            return Error;
+        case 'w':
+        case 'W':
+            return Warning;
+        case 'i':
+        case 'I':
+            return Info;
+        case 'd':
+        case 'D':
+            return Debug;
+        case 'v':
+        case 'V':
+            return Verbose;
+        case 't':
+        case 'T':
+            return Trace;
+        default:
+            return Error;
+        }
+}
+
+inline std::string Logger::_trim(const std::string &str) {
+    auto result = str;
+
+    while (!result.empty() && std::isspace(result[0])) {
+        result.erase(0, 1);
+    }
+
+    while (!result.empty() && std::isspace(result[result.size() - 1])) {
+        result.erase(result.size() - 1);
+    }
+
+    return result;
+}
+
+inline FilePattern::FilePattern(const std::string& pattern)
+    :_pattern(pattern), _parts(), _lastEmpty(-1), _nodes() {
+    _compile();
+}
+
+inline bool FilePattern::matches(const char* file) const {
+    /*
+        Rules:
+        1. No files matches a pattern of "-"
+        2. Any file matches an empty pattern (including an empty file)
+        3. All positive patterns are ORed and all negative patterns are ANDed
+        4. The last part of the pattern that is found in the file decides
+
+        Example:
+        - "-" match nothing
+        - "" match everything
+        - "-bin/" match everything except files that contain "bin/"
+        - "src/;-src/include/" match everything that contains "src/" 
+                                unless it contains "src/include/"
+        - ".h;.cpp;-main.cpp;-test.cpp" match all files that have ".h" or ".cpp" in them
+                                            but don't match any that contain "main.cpp"
+                                                or "test.cpp"
+    */
+    const auto found = _nodes.empty() ? _lastMatchScan(file) : _lastMatchAutomaton(file);
+    const auto last = std::max(found, _lastEmpty);
+
+    return last < 0 || !_parts[static_cast<size_t>(last)].negative;
+}
+
+inline const std::string& FilePattern::pattern() const {
+    return _pattern;
+}
+
+inline int FilePattern::_next(const Node& node, char character) {
+    for (const auto& edge : node.next) {
+        if (edge.first == character) {
+            return edge.second;
+        }
+    }
+
+    return -1;
+}
+
+inline void FilePattern::_compile() {
+    size_t start = 0;
+    size_t needles = 0;
+
+    while (start < _pattern.size()) {
+        const auto end = _pattern.find(';', start);
+        const auto part = _pattern.substr(start, end-start);
+        const auto negative = part.find('-') == 0;
+
+        _parts.push_back(Part {part.substr(negative ? 1 : 0), negative});
+
+        if (_parts.back().name.empty()) {
+            _lastEmpty = static_cast<int>(_parts.size() - 1);
+        } else {
+            needles += 1;
+        }
+
+        start = end < _pattern.size() ? end + 1 : end;
+    }
+
+    if (needles <= ScanThreshold) {
+        return; // strstr on a few needles is faster than the automaton
+    }
+
+    _nodes.push_back(Node {{}, 0, -1});
+
+    for (size_t index = 0; index < _parts.size(); ++index) {
+        size_t node = 0;
+
+        for (const auto character : _parts[index].name) {
+            const auto next = _next(_nodes[node], character);
+
+            if (next < 0) {
+                _nodes[node].next.push_back(std::make_pair(character, static_cast<int>(_nodes.size())));
+                node = _nodes.size();
+                _nodes.push_back(Node {{}, 0, -1});
+            } else {
+                node = static_cast<size_t>(next);
+            }
+        }
+
+        if (node != 0) {
+            _nodes[node].last = std::max(_nodes[node].last, static_cast<int>(index));
+        }
+    }
+
+    std::vector<size_t> queue;
+
+    for (const auto& edge : _nodes[0].next) {
+        queue.push_back(static_cast<size_t>(edge.second));
+    }
+
+    for (size_t position = 0; position < queue.size(); ++position) {
+        const auto node = queue[position];
+
+        for (const auto& edge : _nodes[node].next) {
+            const auto child = static_cast<size_t>(edge.second);
+            auto fail = static_cast<size_t>(_nodes[node].fail);
+            auto next = _next(_nodes[fail], edge.first);
+
+            while (next < 0 && fail != 0) {
+                fail = static_cast<size_t>(_nodes[fail].fail);
+                next = _next(_nodes[fail], edge.first);
+            }
+
+            _nodes[child].fail = next < 0 ? 0 : next;
+            _nodes[child].last = std::max(_nodes[child].last,
+                                          _nodes[static_cast<size_t>(_nodes[child].fail)].last);
+            queue.push_back(child);
+        }
+    }
+}
+
+inline int FilePattern::_lastMatchScan(const char* file) const {
+    for (size_t index = _parts.size(); index > 0; --index) {
+        const auto& part = _parts[index - 1];
+
+        if (!part.name.empty() && nullptr != ::strstr(file, part.name.c_str())) {
+            return static_cast<int>(index - 1);
+        }
+    }
+
+    return -1;
+}
+
+inline int FilePattern::_lastMatchAutomaton(const char* file) const {
+    size_t node = 0;
+    int last = -1;
+
+    for (const char* character = file; *character != '\0'; ++character) {
+        auto next = _next(_nodes[node], *character);
+
+        while (next < 0 && node != 0) {
+            node = static_cast<size_t>(_nodes[node].fail);
+            next = _next(_nodes[node], *character);
+        }
+
+        node = next < 0 ? 0 : static_cast<size_t>(next);
+        last = std::max(last, _nodes[node].last);
+    }
+
+    return last;
+}
+
+template<typename T>
+inline Snapshot<T>::Reader::Reader(const Snapshot& snapshot)
+    :_snapshot(snapshot), _readers(snapshot._stripes[_stripe()].readers[snapshot._epoch.load()]), _value(nullptr) {
+    _readers.fetch_add(1);
+    _value = _snapshot._current.load();
+}
+
+template<typename T>
+inline Snapshot<T>::Reader::~Reader() {
+    _readers.fetch_sub(1);
+
+    if (_snapshot._retiredCount.load(std::memory_order_relaxed) > 0) {
+        _snapshot._reclaim(); // we may have been the last reader of a retired copy
+    }
+}
+
+template<typename T>
+inline const T& Snapshot<T>::Reader::operator*() const {
+    return *_value;
+}
+
+template<typename T>
+inline const T* Snapshot<T>::Reader::operator->() const {
+    return _value;
+}
+
+template<typename T>
+inline Snapshot<T>::Stripe::Stripe()
+    :readers() {
+    readers[0].store(0);
+    readers[1].store(0);
+}
+
+template<typename T>
+inline Snapshot<T>::Snapshot(Ptr initial)
+    :_current(initial.release()), _epoch(0), _stripes(), _retiredCount(0), _retiredMutex(), _retired(),
+     _started(0), _completed(0) {}
+
+template<typename T>
+inline Snapshot<T>::~Snapshot() {
+    for (const auto& retired : _retired) {
+        delete retired.value;
+    }
+
+    delete _current.load();
+}
+
+template<typename T>
+inline const T& Snapshot<T>::currentNeedsLock() const {
+    return *_current.load();
+}
+
+template<typename T>
+inline void Snapshot<T>::publishNeedsLock(Ptr next) {
+    const T* previous = _current.exchange(next.release());
+
+    {
+        std::lock_guard<std::mutex> lock(_retiredMutex);
+
+        // a grace period already running may have missed readers that started before the exchange
+        _retired.push_back(Retired {previous, _started + 2});
+        _retiredCount.store(_retired.size());
+    }
+
+    _reclaim();
+}
+
+template<typename T>
+inline size_t Snapshot<T>::retired() const {
+    return _retiredCount.load();
+}
+
+template<typename T>
+inline size_t Snapshot<T>::_stripe() {
+    static std::atomic<size_t> nextStripe(0);
+    static thread_local const size_t stripe = nextStripe.fetch_add(1) % Stripes;
+
+    return stripe;
+}
+
+template<typename T>
+inline size_t Snapshot<T>::_readersIn(size_t epoch) const {
+    size_t readers = 0;
+
+    for (const auto& stripe : _stripes) {
+        readers += stripe.readers[epoch].load();
+    }
+
+    return readers;
+}
+
+template<typename T>
+inline void Snapshot<T>::_reclaim() const {
+    /*
+        Readers count themselves in the epoch they started in.
+        A grace period flips the epoch and completes once the old side drains,
+        and after two that started since a copy was retired, every reader that could have seen it is done.
+        Deleting happens after unlocking, since destroying a copy may log.
+    */
+    std::vector<const T*> reclaimed;
+
+    {
+        std::unique_lock<std::mutex> lock(_retiredMutex, std::try_to_lock);
+
+        if (!lock.owns_lock()) {
+            return; // whoever holds it reclaims
+        }
+
+        while (!_retired.empty()) {
+            if (_started != _completed) {
+                if (_readersIn(_epoch.load() ^ 1) != 0) {
+                    break; // a reader is still in the old epoch, it reclaims when it leaves
+                }
+
+                ++_completed;
+            }
+
+            auto safe = _retired.begin();
+
+            while (safe != _retired.end() && safe->safeAfter <= _completed) {
+                reclaimed.push_back(safe->value);
+                ++safe;
+            }
+
+            _retired.erase(_retired.begin(), safe);
+
+            if (!_retired.empty()) {
+                _epoch.store(_epoch.load() ^ 1);
+                ++_started;
+            }
+        }
+
+        _retiredCount.store(_retired.size());
+    }
+
+    for (const auto value : reclaimed) {
+        delete value;
+    }
+}
+
+inline RecordRing::RecordRing(size_t capacity)
+    :_mask(_powerOfTwo(capacity) - 1), _records(new Record[_mask + 1]), _head(0), _headPadding(),
+     _tail(0), _cachedHead(0), _closed(false) {}
+
+inline bool RecordRing::push(const Record& source, uint64_t timestamp) {
+    const auto tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail - _cachedHead > _mask) {
+        _cachedHead = _head.load(std::memory_order_acquire);
+
+        if (tail - _cachedHead > _mask) {
+            return false; // full
+        }
+    }
+
+    auto& record = _records[tail & _mask];
+
+    record.level = source.level;
+    record.timestamp = timestamp;
+    record.line.assign(source.line); // reuses the capacity left in the slot
+    record.formatted = source.formatted;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+inline const Record* RecordRing::front() const {
+    const auto head = _head.load(std::memory_order_relaxed);
+
+    if (head == _tail.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    return &_records[head & _mask];
+}
+
+inline void RecordRing::pop(Record& record) {
+    const auto head = _head.load(std::memory_order_relaxed);
+    auto& slot = _records[head & _mask];
+
+    record.level = slot.level;
+    record.timestamp = slot.timestamp;
+    record.line.swap(slot.line);
+    record.formatted.swap(slot.formatted);
+    _head.store(head + 1, std::memory_order_release);
+}
+
+inline size_t RecordRing::pushed() const {
+    return _tail.load();
+}
+
+inline size_t RecordRing::size() const {
+    return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_relaxed);
+}
+
+inline void RecordRing::close() {
+    _closed.store(true);
+}
+
+inline bool RecordRing::closed() const {
+    return _closed.load();
+}
+
+inline size_t RecordRing::_powerOfTwo(size_t minimum) {
+    size_t size = 2;
+
+    while (size < minimum) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+inline AsyncWriter::AsyncWriter(Write write)
+    :_write(write), _rings(), _ringsMutex(), _thread(), _mutex(), _wake(), _written(), _running(false),
+     _sleeping(false), _queueSize(1024), _overflow(Logger::OverflowBlock), _keep(Warning),
+     _writtenCount(0), _droppedCount(0), _highWater(0), _retiredCount(0), _stopping(false) {}
+
+inline AsyncWriter::~AsyncWriter() {
+    _running.store(false);
+
+    if (_thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _stopping = true;
+        }
+
+        _wake.notify_all();
+        _thread.join(); // drains everything queued first
+    }
+}
+
+inline void AsyncWriter::start(size_t queueSize, Logger::Overflow overflow, Level keep) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _queueSize.store(queueSize);
+    _overflow.store(overflow);
+    _keep.store(keep);
+
+    if (!_thread.joinable()) {
+        _thread = std::thread(&AsyncWriter::_run, this);
+    }
+
+    _running.store(true);
+}
+
+inline void AsyncWriter::stop() {
+    _running.store(false);
+    flush();
+}
+
+inline bool AsyncWriter::push(const Record& record) {
+    if (!_running.load() || _onWriterThread()) {
+        return false; // the writer thread writes its own lines directly
+    }
+
+    auto& ring = _threadRing();
+    const auto timestamp = _now();
+
+    while (true) {
+        const auto written = _writtenCount.load(); // read before trying, so a batch written after is not missed
+
+        if (ring.push(record, timestamp)) {
+            break;
+        }
+
+        const auto overflow = _overflow.load();
+        const auto drop = Logger::OverflowDropNewest == overflow
+                        || (Logger::OverflowDropBelowLevel == overflow && record.level > _keep.load());
+
+        if (drop) {
+            _droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        _notify();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_writtenCount.load() == written) {
+            _written.wait_for(lock, std::chrono::milliseconds(100)); // woken when the writer has written a batch
+        }
+    }
+
+    _notify();
+    return true;
+}
+
+inline void AsyncWriter::flush() {
+    if (!_thread.joinable() || _onWriterThread()) {
+        return;
+    }
+
+    const auto target = _pushed();
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (_writtenCount.load() < target) {
+        _wake.notify_all();
+        _written.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
+
+inline size_t AsyncWriter::dropped() const {
+    return _droppedCount.load(std::memory_order_relaxed);
+}
+
+inline size_t AsyncWriter::depth() {
+    const auto pushed = _pushed();
+    const auto written = _writtenCount.load();
+
+    return pushed > written ? pushed - written : 0;
+}
+
+inline size_t AsyncWriter::highWater() const {
+    return _highWater.load(std::memory_order_relaxed);
+}
+
+inline bool& AsyncWriter::_onWriterThread() {
+    static thread_local bool onWriterThread = false;
+
+    return onWriterThread;
+}
+
+inline uint64_t AsyncWriter::_now() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+inline RecordRing& AsyncWriter::_threadRing() {
+    /*
+        Each thread gets its own ring the first time it logs asynchronously.
+        The ring is closed when the thread exits, and the writer frees it once drained.
+    */
+    static thread_local ThreadRing threadRing;
+
+    if (!threadRing.ring) {
+        threadRing.ring = std::make_shared<RecordRing>(_queueSize.load());
+
+        std::unique_lock<std::mutex> lock(_ringsMutex);
+
+        _rings.push_back(threadRing.ring);
+    }
+
+    return *threadRing.ring;
+}
+
+inline size_t AsyncWriter::_pushed() {
+    std::unique_lock<std::mutex> lock(_ringsMutex);
+    size_t pushed = _retiredCount;
+
+    for (const auto& ring : _rings) {
+        pushed += ring->pushed();
+    }
+
+    return pushed;
+}
+
+inline size_t AsyncWriter::_collect(std::vector<Record>& batch) {
+    std::unique_lock<std::mutex> lock(_ringsMutex);
+    size_t count = 0;
+    size_t depth = 0;
+
+    for (const auto& ring : _rings) {
+        depth += ring->size();
+    }
+
+    if (depth > _highWater.load(std::memory_order_relaxed)) {
+        _highWater.store(depth, std::memory_order_relaxed); // only this thread writes it
+    }
+
+    while (count < batch.size()) {
+        RecordRing* oldest = nullptr;
+        uint64_t oldestTimestamp = 0;
+
+        for (const auto& ring : _rings) {
+            const auto record = ring->front();
+
+            if (nullptr != record && (nullptr == oldest || record->timestamp < oldestTimestamp)) {
+                oldest = ring.get();
+                oldestTimestamp = record->timestamp;
+            }
+        }
+
+        if (nullptr == oldest) {
+            break;
+        }
+
+        oldest->pop(batch[count]);
+        count += 1;
+    }
+
+    for (auto ring = _rings.begin(); ring != _rings.end(); ) {
+        if ((*ring)->closed() && nullptr == (*ring)->front()) {
+            _retiredCount += (*ring)->pushed();
+            ring = _rings.erase(ring);
+        } else {
+            ++ring;
+        }
+    }
+
+    return count;
+}
+
+inline void AsyncWriter::_run() {
+    std::vector<Record> batch(BatchSize);
+
+    _onWriterThread() = true;
+
+    while (true) {
+        const auto count = _collect(batch);
+
+        if (count > 0) {
+            _write(batch.data(), count);
+            _writtenCount.fetch_add(count);
+
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _written.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_stopping) {
+            break;
+        }
+
+        _sleeping.store(true);
+
+        if (_writtenCount.load() == _pushed()) {
+            _wake.wait_for(lock, std::chrono::milliseconds(100));
+        }
+
+        _sleeping.store(false);
+
+        if (_writtenCount.load() == _pushed()) {
+            lock.unlock();
+            _write(nullptr, 0); // lets sinks with time limits write what they buffered
+        }
+    }
+}
+
+inline void AsyncWriter::_notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (_sleeping.load()) {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _wake.notify_one();
+    }
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, size_t>::type
+Number::write(char* buffer, T value) {
+    if (value < 0) {
+        // negate as unsigned so the most negative value does not overflow
+        const auto magnitude = 0ULL - static_cast<unsigned long long>(static_cast<long long>(value));
+
+        buffer[0] = '-';
+        return 1 + _unsigned(buffer + 1, magnitude);
+    }
+
+    return _unsigned(buffer, static_cast<unsigned long long>(value));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, size_t>::type
+Number::write(char* buffer, T value) {
+    return _unsigned(buffer, static_cast<unsigned long long>(value));
+}
+
+inline size_t Number::write(char* buffer, float value) {
+    return _shortest(buffer, value, 6);
+}
+
+inline size_t Number::write(char* buffer, double value) {
+    return _shortest(buffer, value, 15);
+}
+
+inline size_t Number::write(char* buffer, long double value) {
+    return _shortest(buffer, value, 18);
+}
+
+inline size_t Number::write(char* buffer, const void* pointer) {
+    static const char hex[] = "0123456789abcdef";
+    auto value = reinterpret_cast<uintptr_t>(pointer);
+    char digits[sizeof(value) * 2];
+    size_t start = sizeof(digits);
+
+    if (0 == value) {
+        buffer[0] = '0';
+        return 1;
+    }
+
+    while (value != 0) {
+        digits[--start] = hex[value & 0xF];
+        value >>= 4;
+    }
+
+    buffer[0] = '0';
+    buffer[1] = 'x';
+    ::memcpy(buffer + 2, digits + start, sizeof(digits) - start);
+    return 2 + sizeof(digits) - start;
+}
+
+inline size_t Number::_unsigned(char* buffer, unsigned long long value) {
+#if __cplusplus >= 201703L
+    return static_cast<size_t>(std::to_chars(buffer, buffer + 20, value).ptr - buffer); // callers may pass buffer + 1
+#else
+    char digits[20];
+    size_t start = sizeof(digits);
+
+    do {
+        digits[--start] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    ::memcpy(buffer, digits + start, sizeof(digits) - start);
+    return sizeof(digits) - start;
+#endif
+}
+
+inline size_t Number::_special(char* buffer, long double value) {
+    const char* text = std::isnan(value) ? "nan" : value < 0 ? "-inf" : "inf";
+    const auto size = ::strlen(text);
+
+    ::memcpy(buffer, text, size);
+    return size;
+}
+
+template<typename T>
+inline size_t Number::_shortest(char* buffer, T value, int fixedDigits) {
+    /*
+        Laid out like %g with fixedDigits precision: plain when the exponent is from -4 to fixedDigits - 1,
+        otherwise d.ddde+XX.
+    */
+    if (!std::isfinite(value)) {
+        return _special(buffer, value);
+    }
+
+    char digits[BufferSize];
+    int exponent = 0;
+    size_t size = 0;
+
+    if (std::signbit(value)) {
+        buffer[size++] = '-';
+        value = -value;
+    }
+
+    if (!(value > 0)) {
+        buffer[size++] = '0';
+        return size;
+    }
+
+    const auto count = _digits(value, digits, exponent);
+    const auto scientific = exponent - 1; // d.ddd * 10^scientific
+
+    if (scientific < -4 || scientific >= fixedDigits) {
+        buffer[size++] = digits[0];
+
+        if (count > 1) {
+            buffer[size++] = '.';
+            ::memcpy(buffer + size, digits + 1, static_cast<size_t>(count - 1));
+            size += static_cast<size_t>(count - 1);
+        }
+
+        buffer[size++] = 'e';
+        buffer[size++] = scientific < 0 ? '-' : '+';
+
+        const auto magnitude = static_cast<unsigned>(scientific < 0 ? -scientific : scientific);
+
+        if (magnitude < 10) {
+            buffer[size++] = '0';
+        }
+
+        return size + _unsigned(buffer + size, magnitude);
+    }
+
+    if (exponent <= 0) {
+        buffer[size++] = '0';
+        buffer[size++] = '.';
+        ::memset(buffer + size, '0', static_cast<size_t>(-exponent));
+        size += static_cast<size_t>(-exponent);
+        ::memcpy(buffer + size, digits, static_cast<size_t>(count));
+        return size + static_cast<size_t>(count);
+    }
+
+    for (int index = 0; index < exponent; ++index) {
+        buffer[size++] = index < count ? digits[index] : '0';
+    }
+
+    if (count > exponent) {
+        buffer[size++] = '.';
+        ::memcpy(buffer + size, digits + exponent, static_cast<size_t>(count - exponent));
+        size += static_cast<size_t>(count - exponent);
+    }
+
+    return size;
+}
+
+template<typename T>
+inline int Number::_digits(T value, char* digits, int& exponent) {
+    /*
+        value = f * 2^e exactly. r / s is the value scaled below 1 and mMinus, mPlus are the distances
+        to the neighboring values' midpoints on the same scale, so each digit is the first one that
+        leaves the value's rounding interval, and the interval is inclusive when f is even.
+    */
+    typedef std::numeric_limits<T> Limits;
+    enum {
+        Widest = Limits::max_exponent > Limits::digits - Limits::min_exponent ? Limits::max_exponent
+                                                                                    : Limits::digits - Limits::min_exponent,
+        Words = (Widest + 40) / 32 + 2,
+    };
+    Big<Words> r;
+    Big<Words> s;
+    Big<Words> mPlus;
+    Big<Words> mMinus;
+    int frexpExponent = 0;
+
+    std::frexp(value, &frexpExponent);
+
+    const int e = std::max(frexpExponent, static_cast<int>(Limits::min_exponent)) - Limits::digits;
+    const auto f = std::ldexp(value, -e); // an integer below 2^digits
+    auto remaining = f;
+
+    r.size = 0;
+
+    do {
+        const auto high = std::floor(std::ldexp(remaining, -32));
+
+        r.words[r.size++] = static_cast<uint32_t>(remaining - std::ldexp(high, 32));
+        remaining = high;
+    } while (remaining > 0);
+
+    const auto even = 0 == (r.words[0] & 1);
+    const auto smallest = std::ldexp(static_cast<T>(1), Limits::digits - 1);
+    const auto unequalGaps = !(f < smallest) && !(smallest < f) && e > Limits::min_exponent - Limits::digits;
+    const auto bits = r.bits() + e; // value is in [2^(bits - 1), 2^bits)
+    auto k = static_cast<int>(std::ceil((bits - 1) * 0.30102999566398114 - 1e-10)); // ceil(log10(value)) or less
+    int count = 0;
+
+    s.assign(unequalGaps ? 2 : 1);
+    mPlus.assign(unequalGaps ? 2 : 1);
+    mMinus.assign(1);
+    r.shiftLeft(unequalGaps ? 2 : 1);
+
+    if (e >= 0) {
+        r.shiftLeft(e);
+        mPlus.shiftLeft(e);
+        mMinus.shiftLeft(e);
+        s.shiftLeft(1);
+    } else {
+        s.shiftLeft(1 - e);
+    }
+
+    if (k >= 0) {
+        s.multiplyPow10(k);
+    } else {
+        r.multiplyPow10(-k);
+        mPlus.multiplyPow10(-k);
+        mMinus.multiplyPow10(-k);
+    }
+
+    while (Big<Words>::compareSum(r, mPlus, s) >= (even ? 0 : 1)) {
+        s.multiply(10);
+        ++k;
+    }
+
+    exponent = k;
+
+    if (s.bits() <= 59) {
+        return _digits64(r.value(), s.value(), mPlus.value(), mMinus.value(), even, digits); // most values
+    }
+
+    while (true) {
+        r.multiply(10);
+        mPlus.multiply(10);
+        mMinus.multiply(10);
+
+        int digit = 0;
+
+        while (Big<Words>::compare(r, s) >= 0) {
+            r.subtract(s);
+            ++digit;
+        }
+
+        const auto low = Big<Words>::compare(r, mMinus) < (even ? 1 : 0);
+        const auto high = Big<Words>::compareSum(r, mPlus, s) >= (even ? 0 : 1);
+
+        if (low && high) {
+            digit += Big<Words>::compareSum(r, r, s) >= 0 ? 1 : 0; // the nearer of the two
+        } else if (high) {
+            digit += 1;
+        }
+
+        digits[count++] = static_cast<char>('0' + digit);
+
+        if (low || high) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+inline int Number::_digits64(uint64_t r, uint64_t s, uint64_t mPlus, uint64_t mMinus, bool even, char* digits) {
+    // the loop in _digits, once s fits in 59 bits so that 10 * s and r + mPlus do not overflow
+    int count = 0;
+
+    while (true) {
+        r *= 10;
+        mPlus *= 10;
+        mMinus *= 10;
+
+        auto digit = static_cast<int>(r / s);
+
+        r %= s;
+
+        const auto low = even ? r <= mMinus : r < mMinus;
+        const auto high = even ? r + mPlus >= s : r + mPlus > s;
+
+        if (low && high) {
+            digit += 2 * r >= s ? 1 : 0;
+        } else if (high) {
+            digit += 1;
+        }
+
+        digits[count++] = static_cast<char>('0' + digit);
+
+        if (low || high) {
+            return count;
+        }
+    }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Weffc++"
+template<size_t Words>
+inline Number::Big<Words>::Big()
+    :size(0) {} // words are written before they are read, and clearing them would cost more than the digits
+#pragma GCC diagnostic pop
+
+template<size_t Words>
+inline void Number::Big<Words>::assign(uint32_t value) {
+    words[0] = value;
+    size = 0 == value ? 0 : 1;
+}
+
+template<size_t Words>
+inline void Number::Big<Words>::shiftLeft(int bits) {
+    const auto wordShift = static_cast<size_t>(bits / 32);
+    const auto bitShift = static_cast<unsigned>(bits % 32);
+
+    if (0 == size) {
+        return;
+    }
+
+    if (0 != bitShift) {
+        uint32_t carry = 0;
+
+        for (size_t index = 0; index < size; ++index) {
+            const auto word = words[index];
+
+            words[index] = (word << bitShift) | carry;
+            carry = word >> (32 - bitShift);
+        }
+
+        if (0 != carry) {
+            words[size++] = carry;
+        }
+    }
+
+    if (0 != wordShift) {
+        for (size_t index = size; index > 0; --index) {
+            words[index - 1 + wordShift] = words[index - 1];
+        }
+
+        for (size_t index = 0; index < wordShift; ++index) {
+            words[index] = 0;
+        }
+
+        size += wordShift;
+    }
+}
+
+template<size_t Words>
+inline void Number::Big<Words>::multiply(uint32_t factor) {
+    uint64_t carry = 0;
+
+    for (size_t index = 0; index < size; ++index) {
+        const auto product = static_cast<uint64_t>(words[index]) * factor + carry;
+
+        words[index] = static_cast<uint32_t>(product);
+        carry = product >> 32;
+    }
+
+    if (0 != carry) {
+        words[size++] = static_cast<uint32_t>(carry);
+    }
+}
+
+template<size_t Words>
+inline void Number::Big<Words>::multiplyPow10(int exponent) {
+    for (; exponent >= 9; exponent -= 9) {
+        multiply(1000000000);
+    }
+
+    static const uint32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+    multiply(powers[exponent]);
+}
+
+template<size_t Words>
+inline void Number::Big<Words>::subtract(const Big& other) {
+    uint32_t borrow = 0;
+
+    for (size_t index = 0; index < size; ++index) {
+        const uint64_t taken = static_cast<uint64_t>(index < other.size ? other.words[index] : 0) + borrow;
+
+        borrow = words[index] < taken ? 1 : 0;
+        words[index] = static_cast<uint32_t>(words[index] - taken);
+    }
+
+    while (size > 0 && 0 == words[size - 1]) {
+        --size;
+    }
+}
+
+template<size_t Words>
+inline int Number::Big<Words>::bits() const {
+    if (0 == size) {
+        return 0;
+    }
+
+    auto top = words[size - 1];
+    int count = static_cast<int>(size - 1) * 32;
+
+    while (0 != top) {
+        ++count;
+        top >>= 1;
+    }
+
+    return count;
+}
+
+template<size_t Words>
+inline uint64_t Number::Big<Words>::value() const {
+    return (size > 0 ? words[0] : 0) | (size > 1 ? static_cast<uint64_t>(words[1]) << 32 : 0);
+}
+
+template<size_t Words>
+inline int Number::Big<Words>::compare(const Big& left, const Big& right) {
+    if (left.size != right.size) {
+        return left.size < right.size ? -1 : 1;
+    }
+
+    for (size_t index = left.size; index > 0; --index) {
+        if (left.words[index - 1] != right.words[index - 1]) {
+            return left.words[index - 1] < right.words[index - 1] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+template<size_t Words>
+inline int Number::Big<Words>::compareSum(const Big& left, const Big& add, const Big& right) {
+    Big sum;
+    uint64_t carry = 0;
+
+    sum.size = std::max(left.size, add.size);
+
+    for (size_t index = 0; index < sum.size; ++index) {
+        carry += static_cast<uint64_t>(index < left.size ? left.words[index] : 0)
+               + (index < add.size ? add.words[index] : 0);
+        sum.words[index] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+
+    if (0 != carry) {
+        sum.words[sum.size++] = static_cast<uint32_t>(carry);
+    }
+
+    return compare(sum, right);
+}
+
+inline SettingsWatcher::SettingsWatcher(Apply apply, Read read)
+    :_apply(apply), _read(read), _path(), _lastContents(), _thread(), _wake(), _stopping(false), _loads(0) {
+    _wake[0] = -1;
+    _wake[1] = -1;
+}
+
+inline SettingsWatcher::~SettingsWatcher() {
+    _stop();
+}
+
+inline void SettingsWatcher::watch(const std::string& path, int checkIntervalSeconds) {
+    _stop();
+
+    if (path != _path) {
+        _lastContents.clear(); // apply a new file even if it matches the last one
+    }
+
+    _path = path;
+
+    if (_path.empty()) {
+        return;
+    }
+
+    _check();
+
+    if (::pipe(_wake) != 0) {
+        const auto error = errno;
+
+        throw SystemError(std::error_code(error, std::generic_category()),
+                          std::string("Unable to watch the settings file: ") + ::strerror(error));
+    }
+
+    ::fcntl(_wake[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(_wake[1], F_SETFD, FD_CLOEXEC);
+    _stopping.store(false);
+    _thread = std::thread(&SettingsWatcher::_run, this, checkIntervalSeconds);
+}
+
+inline uint64_t SettingsWatcher::loads() const {
+    return _loads.load();
+}
+
+inline void SettingsWatcher::_stop() {
+    if (_thread.joinable()) {
+        const char stop = 0;
+
+        _stopping.store(true);
+
+        if (::write(_wake[1], &stop, 1) != 1) {
+            // the thread still sees _stopping when its wait times out
+        }
+
+        _thread.join();
+    }
+
+    for (auto& end : _wake) {
+        if (end >= 0) {
+            ::close(end);
+            end = -1;
+        }
+    }
+}
+
+inline void SettingsWatcher::_check() {
+    const auto contents = _read(_path);
+
+    if (contents.empty() || contents == _lastContents) {
+        return; // doesn't exist, can't read it, or hasn't changed
+    }
+
+    _lastContents = contents;
+    _apply(contents);
+    _loads.fetch_add(1);
+}
+
+inline void SettingsWatcher::_run(int checkIntervalSeconds) {
+    /*
+        The directory is watched rather than the file,
+        so the file can be created later or replaced by renaming another file over it.
+        The file is still checked every checkIntervalSeconds in case a change was not reported.
+    */
+    const int pollMilliseconds = std::max(10, checkIntervalSeconds * 1000);
+    int events = -1;
+
+#if defined(__linux__)
+    events = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (events >= 0 && ::inotify_add_watch(events, _directory(_path).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        ::close(events);
+        events = -1;
+    }
+#elif defined(__APPLE__)
+    const auto directory = ::open(_directory(_path).c_str(), O_EVTONLY);
+
+    events = directory < 0 ? -1 : ::kqueue();
+
+    if (events >= 0) {
+        struct kevent change;
+
+        EV_SET(&change, directory, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, nullptr);
+
+        if (::kevent(events, &change, 1, nullptr, 0, nullptr) < 0) {
+            ::close(events);
+            events = -1;
+        }
+    }
+#endif
+
+    const int timeout = events < 0 ? pollMilliseconds : std::max(1000, pollMilliseconds);
+
+    _check(); // anything changed before the watch started
+
+    while (_woken(timeout, events)) {
+        _check();
+    }
+
+    if (events >= 0) {
+        ::close(events);
+    }
+
+#if defined(__APPLE__)
+    if (directory >= 0) {
+        ::close(directory);
+    }
+#endif
+}
+
+inline bool SettingsWatcher::_woken(int timeoutMilliseconds, int events) {
+    /*
+        Waits for the stop pipe, a change event, or the timeout,
+        and drains the events so the next wait blocks again.
+    */
+    struct pollfd waitOn[2];
+
+    waitOn[0].fd = _wake[0];
+    waitOn[0].events = POLLIN;
+    waitOn[0].revents = 0;
+    waitOn[1].fd = events;
+    waitOn[1].events = POLLIN;
+    waitOn[1].revents = 0;
+
+    if (::poll(waitOn, events < 0 ? 1 : 2, timeoutMilliseconds) < 0 && errno != EINTR) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMilliseconds));
+    }
+
+    if (_stopping.load()) {
+        return false;
+    }
+
+    if (events >= 0 && (waitOn[1].revents & POLLIN) != 0) {
+#if defined(__linux__)
+        char drain[4096];
+
+        while (::read(events, drain, sizeof(drain)) > 0) {
+            // only that something changed matters
+        }
+#elif defined(__APPLE__)
+        struct kevent event;
+        const struct timespec noWait = {0, 0};
+
+        while (::kevent(events, nullptr, 0, &event, 1, &noWait) > 0) {
+            // only that something changed matters
+        }
+#endif
+    }
+
+    return true;
+}
+
+inline std::string SettingsWatcher::_directory(const std::string& path) {
+    const auto slash = path.rfind('/');
+
+    if (std::string::npos == slash) {
+        return ".";
+    }
+
+    return 0 == slash ? "/" : path.substr(0, slash);
+}
+
+inline BinaryLog::BinaryLog()
+    :_mutex(), _file(nullptr), _active(false), _generation(0), _nextId(0), _entry() {}
+
+inline BinaryLog::~BinaryLog() {
+    if (nullptr != _file) {
+        if (::fclose(_file) != 0) {
+            // too late
+        }
+    }
+}
+
+inline void BinaryLog::open(const std::string& path) {
+    Logger::Lock lock(_mutex);
+
+    _active.store(false);
+
+    if (nullptr != _file) {
+        if (::fclose(_file) != 0) {
+            // nothing more we can do with it
+        }
+
+        _file = nullptr;
+    }
+
+    if (path.empty()) {
+        return;
+    }
+
+    const auto opened = ::fopen(path.c_str(), "ab");
+
+    if (nullptr == opened) {
+        const auto error = errno;
+
+        throw std::system_error(
+            std::error_code(error, std::generic_category()),
+            "Failed to open binary log '" + path + "': " + ::strerror(error)
+        );
+    }
+
+    if (::ftell(opened) == 0 && ::fwrite(magic(), 1, MagicSize, opened) != MagicSize) {
+        ::fclose(opened);
+        throw std::runtime_error("Incomplete write to " + path);
+    }
+
+    _file = opened;
+    _generation += 1; // every call site and thread name is described again in this file
+    _nextId = 0;
+    _active.store(true);
+}
+
+inline bool BinaryLog::active() const {
+    return _active.load(std::memory_order_relaxed);
+}
+
+inline void BinaryLog::write(const Logger& logger, size_t thread, const char* arguments, size_t size, bool pad) {
+    static thread_local ThreadName written;
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    Logger::Lock lock(_mutex);
+    uint32_t id = 0;
+
+    if (nullptr == _file) {
+        return; // closed since the line started
+    }
+
+    _entry.clear();
+
+    if (nullptr == logger.callsite) {
+        _putSite(0, logger); // id 0 describes the site of the next line only
+    } else {
+        const auto known = logger.callsite->_binaryId.load(std::memory_order_relaxed);
+
+        if ((known >> 32) == _generation) {
+            id = static_cast<uint32_t>(known);
+        } else {
+            id = ++_nextId;
+            logger.callsite->_binaryId.store((static_cast<uint64_t>(_generation) << 32) | id,
+                                             std::memory_order_relaxed);
+            _putSite(id, logger);
+        }
+    }
+
+    if (written.generation != _generation || written.name != Logger::threadName()) {
+        written.generation = _generation;
+        written.name = Logger::threadName();
+        _entry.append(1, static_cast<char>(ThreadEntry));
+        _put(static_cast<uint64_t>(thread));
+        _putString(written.name.c_str());
+    }
+
+    _entry.append(1, static_cast<char>(LineEntry));
+    _put(id);
+    _put(static_cast<int64_t>(nanoseconds));
+    _put(static_cast<uint64_t>(thread));
+    _put(static_cast<uint8_t>(pad ? 1 : 0));
+    _put(static_cast<uint32_t>(size));
+    _entry.append(arguments, size);
+
+    if (::fwrite(_entry.data(), 1, _entry.size(), _file) != _entry.size()) {
+        throw std::runtime_error("Incomplete write to binary log");
+    }
+}
+
+inline void BinaryLog::flush() {
+    Logger::Lock lock(_mutex);
+
+    if (nullptr != _file) {
+        ::fflush(_file);
+    }
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+BinaryLog::append(MessageBuffer& arguments, T value) {
+    _append(arguments, SignedArgument, static_cast<int64_t>(value));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+BinaryLog::append(MessageBuffer& arguments, T value) {
+    _append(arguments, UnsignedArgument, static_cast<uint64_t>(value));
+}
+
+inline void BinaryLog::append(MessageBuffer& arguments, float value) {
+    _append(arguments, FloatArgument, value);
+}
+
+inline void BinaryLog::append(MessageBuffer& arguments, double value) {
+    _append(arguments, DoubleArgument, value);
+}
+
+inline void BinaryLog::append(MessageBuffer& arguments, long double value) {
+    _append(arguments, LongDoubleArgument, value);
+}
+
+inline void BinaryLog::append(MessageBuffer& arguments, const void* pointer) {
+    _append(arguments, PointerArgument, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(pointer)));
+}
+
+inline void BinaryLog::append(MessageBuffer& arguments, const char* text, size_t size) {
+    _append(arguments, StringArgument, static_cast<uint32_t>(size));
+    arguments.append(text, size);
+}
+
+inline const char* BinaryLog::magic() {
+    return "yalobin1";
+}
+
+template<typename T>
+inline void BinaryLog::_append(MessageBuffer& arguments, char type, T value) {
+    char bytes[1 + sizeof(value)];
+
+    bytes[0] = type;
+    ::memcpy(bytes + 1, &value, sizeof(value));
+    arguments.append(bytes, sizeof(bytes));
+}
+
+template<typename T>
+inline void BinaryLog::_put(T value) {
+    char bytes[sizeof(value)];
+
+    ::memcpy(bytes, &value, sizeof(value));
+    _entry.append(bytes, sizeof(bytes));
+}
+
+inline void BinaryLog::_putString(const char* text) {
+    if (nullptr == text) {
+        _put(static_cast<uint32_t>(NoString));
+        return;
+    }
+
+    const auto size = ::strlen(text);
+
+    _put(static_cast<uint32_t>(size));
+    _entry.append(text, size);
+}
+
+inline void BinaryLog::_putSite(uint32_t id, const Logger& logger) {
+    _entry.append(1, static_cast<char>(SiteEntry));
+    _put(id);
+    _put(static_cast<uint8_t>(logger.levelRequested));
+    _put(static_cast<int32_t>(logger.line));
+    _putString(logger.file);
+    _putString(logger.function);
+    _putString(logger.condition);
+}
+
+inline BinaryDecoder::BinaryDecoder(DefaultFormatter::Location location, DefaultFormatter::Precision precision)
+    :_formatter(location, precision), _sites(), _threadNames() {}
+
+inline void BinaryDecoder::decode(FILE* input, ISink& output) {
+    char magic[BinaryLog::MagicSize];
+    char entry = 0;
+    std::string arguments;
+    std::string text;
+    std::string line;
+
+    _sites.clear();
+    _threadNames.clear();
+
+    if (!_read(input, magic, sizeof(magic), true)) {
+        return; // nothing logged
+    }
+
+    if (::memcmp(magic, BinaryLog::magic(), sizeof(magic)) != 0) {
+        throw RuntimeError("Not a yalo binary log");
+    }
+
+    while (_read(input, &entry, 1, true)) {
+        if (BinaryLog::SiteEntry == entry) {
+            const auto id = _get<uint32_t>(input);
+            Site site;
+            const auto level = _get<uint8_t>(input);
+
+            if (level > static_cast<uint8_t>(Trace)) {
+                throw RuntimeError("Invalid level in binary log: " + std::to_string(level));
+            }
+
+            site.level = static_cast<Level>(level);
+            site.line = _get<int32_t>(input);
+            site.hasFile = _getString(input, site.file);
+            site.hasFunction = _getString(input, site.function);
+            site.hasCondition = _getString(input, site.condition);
+            _sites[id] = site;
+        } else if (BinaryLog::ThreadEntry == entry) {
+            const auto thread = _get<uint64_t>(input);
+
+            _getString(input, _threadNames[thread]);
+        } else if (BinaryLog::LineEntry == entry) {
+            const auto id = _get<uint32_t>(input);
+            const auto nanoseconds = _get<int64_t>(input);
+            const auto thread = _get<uint64_t>(input);
+            const auto pad = _get<uint8_t>(input) != 0;
+            const auto found = _sites.find(id);
+
+            arguments.assign(_get<uint32_t>(input), '\0');
+
+            if (!arguments.empty()) {
+                _read(input, &arguments[0], arguments.size());
+            }
+
+            if (found == _sites.end()) {
+                throw RuntimeError("Unknown call site in binary log: " + std::to_string(id));
+            }
+
+            const auto& site = found->second;
+            const Logger logger(site.level, site.hasFile ? site.file.c_str() : nullptr, site.line,
+                                site.hasFunction ? site.function.c_str() : nullptr, false,
+                                site.hasCondition ? site.condition.c_str() : nullptr);
+            const auto when = std::chrono::duration_cast<Logger::Timestamp::duration>(
+                                                                std::chrono::nanoseconds(nanoseconds));
+
+            _text(arguments, pad, text);
+            line.clear();
+            _formatter.formatAt(line, text.data(), text.size(), static_cast<size_t>(thread),
+                                _threadNames[thread], logger, Logger::Timestamp(when));
+            output.log(line);
+        } else {
+            throw RuntimeError("Corrupt binary log");
+        }
+    }
+}
+
+inline bool BinaryDecoder::_read(FILE* input, void* data, size_t size, bool endAllowed) {
+    const auto amount = ::fread(data, 1, size, input);
+
+    if (amount == size) {
+        return true;
+    }
+
+    if (endAllowed && 0 == amount && ::feof(input)) {
+        return false;
+    }
+
+    throw RuntimeError("Truncated binary log");
+}
+
+template<typename T>
+inline T BinaryDecoder::_get(FILE* input) {
+    T value;
+
+    _read(input, &value, sizeof(value));
+    return value;
+}
+
+inline bool BinaryDecoder::_getString(FILE* input, std::string& text) {
+    const auto size = _get<uint32_t>(input);
+
+    text.clear();
+
+    if (BinaryLog::NoString == size) {
+        return false;
+    }
+
+    text.assign(size, '\0');
+
+    if (size > 0) {
+        _read(input, &text[0], size);
+    }
+
+    return true;
+}
+
+template<typename T>
+inline T BinaryDecoder::_argument(const std::string& arguments, size_t& offset) {
+    T value;
+
+    if (offset + sizeof(value) > arguments.size()) {
+        throw RuntimeError("Truncated binary log arguments");
+    }
+
+    ::memcpy(&value, arguments.data() + offset, sizeof(value));
+    offset += sizeof(value);
+    return value;
+}
+
+inline void BinaryDecoder::_text(const std::string& arguments, bool pad, std::string& text) {
+    char number[Number::BufferSize];
+    size_t offset = 0;
+
+    text.clear();
+
+    while (offset < arguments.size()) {
+        const auto type = arguments[offset];
+        size_t size = 0;
+
+        offset += 1;
+
+        if (pad && !text.empty()) {
+            text.append(1, ' ');
+        }
+
+        switch(type) {
+            case BinaryLog::SignedArgument:
+                size = Number::write(number, _argument<int64_t>(arguments, offset));
+                break;
+            case BinaryLog::UnsignedArgument:
+                size = Number::write(number, _argument<uint64_t>(arguments, offset));
+                break;
+            case BinaryLog::FloatArgument:
+                size = Number::write(number, _argument<float>(arguments, offset));
+                break;
+            case BinaryLog::DoubleArgument:
+                size = Number::write(number, _argument<double>(arguments, offset));
+                break;
+            case BinaryLog::LongDoubleArgument:
+                size = Number::write(number, _argument<long double>(arguments, offset));
+                break;
+            case BinaryLog::PointerArgument:
+                size = Number::write(number, reinterpret_cast<const void*>(
+                                        static_cast<uintptr_t>(_argument<uint64_t>(arguments, offset))));
+                break;
+            case BinaryLog::StringArgument: {
+                const auto length = _argument<uint32_t>(arguments, offset);
+
+                if (offset + length > arguments.size()) {
+                    throw RuntimeError("Truncated binary log arguments");
+                }
+
+                text.append(arguments, offset, length);
+                offset += length;
+                continue;
+            }
+            default:
+                throw RuntimeError("Corrupt binary log arguments");
+        }
+
+        text.append(number, size);
+    }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Weffc++"
+inline MessageBuffer::MessageBuffer()
+    :_heap(), _data(_inline), _size(0), _capacity(InlineSize) {} // _inline is left uninitialized, only _size bytes are read
+#pragma GCC diagnostic pop
+
+inline void MessageBuffer::append(const char* data, size_t size) {
+    if (_size + size > _capacity) {
+        _grow(_size + size);
+    }
+
+    ::memcpy(_data + _size, data, size);
+    _size += size;
+}
+
+inline void MessageBuffer::append(char character) {
+    append(&character, 1);
+}
+
+inline const char* MessageBuffer::data() const {
+    return _data;
+}
+
+inline size_t MessageBuffer::size() const {
+    return _size;
+}
+
+inline bool MessageBuffer::empty() const {
+    return 0 == _size;
+}
+
+inline void MessageBuffer::clear() {
+    _size = 0;
+}
+
+inline void MessageBuffer::_grow(size_t minimum) {
+    auto capacity = _capacity * 2;
+
+    while (capacity < minimum) {
+        capacity *= 2;
+    }
+
+    std::unique_ptr<char[]> heap(new char[capacity]);
+
+    ::memcpy(heap.get(), _data, _size);
+    _heap = std::move(heap);
+    _data = _heap.get();
+    _capacity = capacity;
+}
+
+template<typename T, typename>
+inline KeyValue::KeyValue(const char* name, T number)
+    :key(name), keySize(::strlen(name)), kind(Numeric), _text(nullptr), _number(), _size(Number::write(_number, number)) {}
+
+inline KeyValue::KeyValue(const char* name, bool flag)
+    :key(name), keySize(::strlen(name)), kind(Boolean), _text(flag ? "true" : "false"), _number(),
+     _size(flag ? 4 : 5) {}
+
+inline KeyValue::KeyValue(const char* name, const char* text)
+    :key(name), keySize(::strlen(name)), kind(String), _text(nullptr == text ? "" : text),
+     _number(), _size(nullptr == text ? 0 : ::strlen(text)) {}
+
+inline KeyValue::KeyValue(const char* name, const std::string& text)
+    :key(name), keySize(::strlen(name)), kind(String), _text(text.data()), _number(), _size(text.size()) {}
+
+inline KeyValue::KeyValue(const KeyValue& other)
+    :key(other.key), keySize(other.keySize), kind(other.kind), _text(other._text), _number(), _size(other._size) {
+    ::memcpy(_number, other._number, sizeof(_number));
+}
+
+inline const char* KeyValue::value() const {
+    return nullptr == _text ? _number : _text;
+}
+
+inline size_t KeyValue::valueSize() const {
+    return _size;
+}
+
+template<typename T>
+inline KeyValue kv(const char* key, const T& value) {
+    return KeyValue(key, value);
+}
+
+inline Fields::Field::Field()
+    :key(nullptr), keySize(0), value(nullptr), valueSize(0), kind(KeyValue::String) {}
+
+inline Fields::Fields(const char* data, size_t size)
+    :_at(data), _end(data + size) {}
+
+inline bool Fields::empty() const {
+    return _at == _end;
+}
+
+inline bool Fields::next(Field& field) {
+    if (_at >= _end) {
+        return false;
+    }
+
+    // kind, key size, key, value size, value
+    field.kind = static_cast<KeyValue::Kind>(*_at++);
+    field.keySize = _readSize(_at);
+    field.key = _at;
+    _at += field.keySize;
+    field.valueSize = _readSize(_at);
+    field.value = _at;
+    _at += field.valueSize;
+    return true;
+}
+
+inline void Fields::append(MessageBuffer& fields, const KeyValue& field) {
+    _append(fields, field.kind, field.key, field.keySize, field.value(), field.valueSize());
+}
+
+inline void Fields::append(MessageBuffer& fields, const Field& field) {
+    _append(fields, field.kind, field.key, field.keySize, field.value, field.valueSize);
+}
+
+inline size_t Fields::encodedSize(const Field& field) {
+    return 1 + 2 * sizeof(uint32_t) + field.keySize + field.valueSize;
+}
+
+inline void Fields::_append(MessageBuffer& fields, KeyValue::Kind kind, const char* key, size_t keySize,
+                            const char* value, size_t valueSize) {
+    const uint32_t keyLength = static_cast<uint32_t>(keySize);
+    const uint32_t valueLength = static_cast<uint32_t>(valueSize);
+
+    fields.append(static_cast<char>(kind));
+    fields.append(reinterpret_cast<const char*>(&keyLength), sizeof(keyLength));
+    fields.append(key, keyLength);
+    fields.append(reinterpret_cast<const char*>(&valueLength), sizeof(valueLength));
+    fields.append(value, valueLength);
+}
+
+inline size_t Fields::_readSize(const char*& at) {
+    uint32_t size = 0;
+
+    ::memcpy(&size, at, sizeof(size));
+    at += sizeof(size);
+    return size;
+}
+
+template<typename T>
+inline Context::Context(const char* key, const T& value)
+    :Context(KeyValue(key, value)) {}
+
+inline Context::Context(const KeyValue& field)
+    :_parent(_top()), _fields(), _text(), _json(), _logfmt() {
+    MessageBuffer encoded;
+    Fields::Field rendered;
+
+    Fields::append(encoded, field);
+
+    if (nullptr != _parent) {
+        _fields = _parent->_fields;
+        _text = _parent->_text;
+        _json = _parent->_json;
+        _logfmt = _parent->_logfmt;
+    }
+
+    _fields.append(encoded.data(), encoded.size());
+
+    auto own = Fields(encoded.data(), encoded.size());
+
+    own.next(rendered);
+    _text.append(rendered.key, rendered.keySize);
+    _text.append(1, '=');
+    _text.append(rendered.value, rendered.valueSize);
+    _text.append(1, ' ');
+    StructuredFormatter(StructuredFormatter::Json).appendField(_json, rendered, true);
+    _json.append(1, ',');
+    StructuredFormatter(StructuredFormatter::Logfmt).appendField(_logfmt, rendered, false);
+    _top() = this;
+}
+
+inline Context::~Context() {
+    _top() = _parent;
+}
+
+inline const Context* Context::current() {
+    return _top();
+}
+
+inline Fields Context::fields() const {
+    return Fields(_fields.data(), _fields.size());
+}
+
+inline const std::string& Context::text() const {
+    return _text;
+}
+
+inline const std::string& Context::json() const {
+    return _json;
+}
+
+inline const std::string& Context::logfmt() const {
+    return _logfmt;
+}
+
+inline Context::Suspended::Suspended()
+    :_saved(_top()) {
+    _top() = nullptr;
+}
+
+inline Context::Suspended::~Suspended() {
+    _top() = _saved;
+}
+
+inline const Context*& Context::_top() {
+    static thread_local const Context* top = nullptr;
+
+    return top;
+}
+
+inline ThreadCounters::Block::Block()
+    :counts() {
+    for (auto& count : counts) {
+        count.store(0);
+    }
+
+    auto& registry = _registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    registry.blocks.push_back(this);
+}
+
+inline ThreadCounters::Block::~Block() {
+    auto& registry = _registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    for (int counter = 0; counter < CounterCount; ++counter) {
+        registry.retired[counter] += counts[counter].load(std::memory_order_relaxed);
+    }
+
+    registry.blocks.erase(std::remove(registry.blocks.begin(), registry.blocks.end(), this), registry.blocks.end());
+}
+
+inline ThreadCounters::Registry::Registry()
+    :mutex(), blocks(), retired() {}
+
+inline void ThreadCounters::add(Counter counter, uint64_t amount) {
+    auto& count = _block().counts[counter];
+
+    // only this thread writes it, so there is no need for a locked add
+    count.store(count.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline uint64_t ThreadCounters::total(Counter counter) {
+    auto& registry = _registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto sum = registry.retired[counter];
+
+    for (const auto block : registry.blocks) {
+        sum += block->counts[counter].load(std::memory_order_relaxed);
+    }
+
+    return sum;
+}
+
+inline ThreadCounters::Registry& ThreadCounters::_registry() {
+    static Registry registry;
+
+    return registry;
+}
+
+inline ThreadCounters::Block& ThreadCounters::_block() {
+    // a plain pointer is cheaper to reach than a thread local that needs a constructor
+    static thread_local Block* cached = nullptr;
+
+    if (nullptr == cached) {
+        static thread_local Block block;
+
+        cached = &block;
+    }
+
+    return *cached;
+}
+
+inline uint64_t SinkStats::latencyPercentile(double fraction) const {
+    uint64_t total = 0;
+    uint64_t seen = 0;
+
+    for (const auto count : latency) {
+        total += count;
+    }
+
+    for (size_t bucket = 0; bucket < latency.size(); ++bucket) {
+        seen += latency[bucket];
+
+        if (total > 0 && static_cast<double>(seen) >= fraction * static_cast<double>(total)) {
+            return uint64_t(1) << bucket;
+        }
+    }
+
+    return 0;
+}
+
+inline FlightRecorder::Slot::Slot()
+    :sequence(0), level(Log), textSize(0), fieldsSize(0), thread(0), nanoseconds(0), file(nullptr), line(0),
+     function(nullptr), condition(nullptr) {}
+
+inline FlightRecorder::Ring::Ring(size_t lines, size_t bytes)
+    :capacity(lines), lineBytes(bytes), slotWords((bytes + 7) / 8), slots(new Slot[lines]),
+     words(new std::atomic<uint64_t>[lines * slotWords]), next(0), collected(0) {
+    for (size_t word = 0; word < lines * slotWords; ++word) {
+        words[word].store(0, std::memory_order_relaxed);
+    }
+}
+
+inline FlightRecorder::FlightRecorder(Dump dump)
+    :_dump(dump), _level(-1), _ring(nullptr), _rings(), _mutex(), _thread(), _pipe() {
+    _pipe[0] = -1;
+    _pipe[1] = -1;
+}
+
+inline FlightRecorder::~FlightRecorder() {
+    if (_thread.joinable()) {
+        const char stop = 0;
+
+        _signalPipe().store(-1);
+
+        if (::write(_pipe[1], &stop, 1) == 1) {
+            _thread.join();
+        } else {
+            _thread.detach();
+        }
+    }
+
+    if (_pipe[0] >= 0) {
+        ::close(_pipe[0]);
+        ::close(_pipe[1]);
+    }
+}
+
+inline void FlightRecorder::configure(size_t lines, Level level, size_t lineBytes) {
+    Logger::Lock lock(_mutex);
+
+    if (0 == lines) {
+        _level.store(-1);
+        return;
+    }
+
+    const auto current = _ring.load();
+
+    if (nullptr == current || current->capacity != lines || current->lineBytes != lineBytes) {
+        _rings.push_back(std::unique_ptr<Ring>(new Ring(lines, lineBytes)));
+        _ring.store(_rings.back().get());
+    }
+
+    _level.store(level);
+}
+
+inline bool FlightRecorder::wants(Level level) const {
+    return static_cast<int>(level) <= _level.load(std::memory_order_relaxed);
+}
+
+inline void FlightRecorder::record(const Logger& logger, size_t thread, const char* line, size_t size) {
+    const auto ring = _ring.load(std::memory_order_acquire);
+
+    if (nullptr == ring) {
+        return;
+    }
+
+    static thread_local MessageBuffer payload; // text, then fields, so steady state recording does not allocate
+    const auto textSize = std::min(size, ring->lineBytes);
+    const auto context = Context::current();
+    Fields::Field field;
+
+    payload.clear();
+    payload.append(line, textSize);
+
+    for (int source = 0; source < 2; ++source) {
+        auto fields = 0 == source ? (nullptr == context ? Fields(nullptr, 0) : context->fields()) : logger.fields();
+
+        while (fields.next(field)) {
+            if (payload.size() + Fields::encodedSize(field) <= ring->lineBytes) {
+                Fields::append(payload, field);
+            }
+        }
+    }
+
+    const auto index = ring->next.fetch_add(1, std::memory_order_relaxed);
+    auto& slot = ring->slots[index % ring->capacity];
+    auto sequence = slot.sequence.load(std::memory_order_relaxed);
+
+    do {
+        if (0 != (sequence & 1) || sequence >= 2 * index + 2) {
+            return; // a writer a lap ahead, or still writing a lap behind, has the slot
+        }
+    } while (!slot.sequence.compare_exchange_weak(sequence, 2 * index + 1, std::memory_order_relaxed));
+
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    const auto words = &ring->words[(index % ring->capacity) * ring->slotWords];
+
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.level.store(logger.levelRequested, std::memory_order_relaxed);
+    slot.textSize.store(textSize, std::memory_order_relaxed);
+    slot.fieldsSize.store(payload.size() - textSize, std::memory_order_relaxed);
+    slot.thread.store(thread, std::memory_order_relaxed);
+    slot.nanoseconds.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), std::memory_order_relaxed);
+    slot.file.store(logger.file, std::memory_order_relaxed);
+    slot.line.store(logger.line, std::memory_order_relaxed);
+    slot.function.store(logger.function, std::memory_order_relaxed);
+    slot.condition.store(logger.condition, std::memory_order_relaxed);
+
+    for (size_t offset = 0; offset < payload.size(); offset += 8) {
+        uint64_t word = 0;
+
+        ::memcpy(&word, payload.data() + offset, std::min<size_t>(8, payload.size() - offset));
+        words[offset / 8].store(word, std::memory_order_relaxed);
+    }
+
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+inline size_t FlightRecorder::collect(std::vector<Record>& records, IFormatter& formatter) {
+    Logger::Lock lock(_mutex);
+    const auto ring = _ring.load();
+
+    if (nullptr == ring) {
+        return 0;
+    }
+
+    const auto next = ring->next.load(std::memory_order_acquire);
+    const auto oldest = next > ring->capacity ? next - ring->capacity : 0;
+    const auto defaultFormatter = dynamic_cast<DefaultFormatter*>(&formatter);
+    const Context::Suspended noContext; // the recorded fields hold the context the line was logged in
+    std::string payload;
+
+    for (auto index = std::max(oldest, ring->collected); index < next; ++index) {
+        const auto& slot = ring->slots[index % ring->capacity];
+        const auto sequence = slot.sequence.load(std::memory_order_acquire);
+
+        if (sequence != 2 * index + 2) {
+            continue; // still being written, or already overwritten
+        }
+
+        const auto level = static_cast<Level>(slot.level.load(std::memory_order_relaxed));
+        const auto textSize = std::min(slot.textSize.load(std::memory_order_relaxed), ring->lineBytes);
+        const auto fieldsSize = std::min(slot.fieldsSize.load(std::memory_order_relaxed), ring->lineBytes - textSize);
+        const auto thread = slot.thread.load(std::memory_order_relaxed);
+        const auto nanoseconds = slot.nanoseconds.load(std::memory_order_relaxed);
+        const auto file = slot.file.load(std::memory_order_relaxed);
+        const auto line = slot.line.load(std::memory_order_relaxed);
+        const auto function = slot.function.load(std::memory_order_relaxed);
+        const auto condition = slot.condition.load(std::memory_order_relaxed);
+        const auto words = &ring->words[(index % ring->capacity) * ring->slotWords];
+
+        payload.clear();
+
+        for (size_t offset = 0; offset < textSize + fieldsSize; offset += 8) {
+            const auto word = words[offset / 8].load(std::memory_order_relaxed);
+            char bytes[8];
+
+            ::memcpy(bytes, &word, sizeof(bytes));
+            payload.append(bytes, std::min<size_t>(8, textSize + fieldsSize - offset));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            continue; // overwritten while we copied it
+        }
+
+        Logger logger(level, file, line, function, false, condition);
+        const std::string text(payload, 0, textSize);
+
+        logger._fields.append(payload.data() + textSize, fieldsSize);
+        records.push_back(Record(level));
+
+        if (nullptr != defaultFormatter) {
+            const Logger::Timestamp when(std::chrono::duration_cast<Logger::Timestamp::duration>(
+                                             std::chrono::nanoseconds(nanoseconds)));
+
+            defaultFormatter->formatAt(records.back().line, text.data(), text.size(), thread, std::string(), logger, when);
+        } else {
+            records.back().line = formatter.format(text, thread, logger);
+        }
+    }
+
+    ring->collected = next;
+    return records.size();
+}
+
+inline void FlightRecorder::dumpOnSignal(int signal) {
+    {
+        Logger::Lock lock(_mutex);
+
+        if (!_thread.joinable()) {
+            if (::pipe(_pipe) != 0) {
+                throw std::system_error(std::error_code(errno, std::generic_category()), "Unable to create pipe");
+            }
+
+            ::fcntl(_pipe[0], F_SETFD, FD_CLOEXEC);
+            ::fcntl(_pipe[1], F_SETFD, FD_CLOEXEC);
+            ::fcntl(_pipe[1], F_SETFL, ::fcntl(_pipe[1], F_GETFL) | O_NONBLOCK);
+            _signalPipe().store(_pipe[1]);
+            _thread = std::thread(&FlightRecorder::_run, this);
+        }
+    }
+
+    struct sigaction action;
+
+    ::memset(&action, 0, sizeof(action));
+    action.sa_handler = _signaled;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(signal, &action, nullptr);
+}
+
+inline std::atomic<int>& FlightRecorder::_signalPipe() {
+    static std::atomic<int> pipe(-1);
+
+    return pipe;
+}
+
+inline void FlightRecorder::_signaled(int /*signal*/) {
+    const auto pipe = _signalPipe().load();
+    const char dump = 1;
+
+    if (pipe >= 0) {
+        const auto saved = errno; // only write() here, it is safe in a signal handler
+
+        if (::write(pipe, &dump, 1) < 0) {
+            // already a dump waiting
+        }
+
+        errno = saved;
+    }
+}
+
+inline void FlightRecorder::_run() {
+    char byte = 0;
+
+    while (true) {
+        const auto got = ::read(_pipe[0], &byte, 1);
+
+        if (got < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if (got <= 0 || 0 == byte) {
+            return;
+        }
+
+        try {
+            _dump();
+        } catch(const std::exception&) {
+            // the sinks report their own failures
+        }
+    }
+}
+
+inline PeriodicTask::PeriodicTask(Task task)
+    :_task(task), _thread(), _mutex(), _wake(), _stopping(false) {}
+
+inline PeriodicTask::~PeriodicTask() {
+    stop();
+}
+
+inline void PeriodicTask::start(int intervalMilliseconds) {
+    stop();
+
+    Logger::Lock lock(_mutex);
+
+    _stopping = false;
+    _thread = std::thread(&PeriodicTask::_run, this, intervalMilliseconds);
+}
+
+inline void PeriodicTask::stop() {
+    {
+        Logger::Lock lock(_mutex);
+
+        _stopping = true;
+    }
+
+    _wake.notify_all();
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+inline void PeriodicTask::_run(int intervalMilliseconds) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_wake.wait_for(lock, std::chrono::milliseconds(intervalMilliseconds), [this]() {return _stopping;})) {
+        lock.unlock();
+        _task();
+        lock.lock();
+    }
+}
+
+inline CallSite::CallSite(Level lvl, const char* fl, int ln, const char* func, const char* cond)
+    :level(lvl), file(fl), line(ln), function(func), condition(cond), _state(0), _binaryId(0) {}
+
+inline bool CallSite::enabled() const {
+    const auto state = _levelState();
+
+    ThreadCounters::add(0 != (state & Shown) ? ThreadCounters::Shown : ThreadCounters::Filtered);
+    return 0 != state;
+}
+
+inline bool CallSite::_shown() const {
+    return 0 != (_levelState() & Shown);
+}
+
+inline uint64_t CallSite::_levelState() const {
+    /*
+        The shown() result only changes when the levels change,
+        so it is cached until the levels generation moves on.
+    */
+    const auto generation = Logger::_generation().load();
+    const auto state = _state.load(std::memory_order_relaxed);
+
+    if ((state >> 2) == generation) {
+        return state & (Shown | Recorded);
+    }
+
+    const auto shown = Logger::_wanted(level, file);
+    const uint64_t levelState = shown ? Shown : Logger::_flightRecorder().wants(level) ? Recorded : 0;
+
+    _state.store((static_cast<uint64_t>(generation) << 2) | levelState, std::memory_order_relaxed);
+    return levelState;
+}
+
+inline RateLimitedSite::RateLimitedSite(Level lvl, const char* fl, int ln, const char* func, Kind knd, uint64_t amnt)
+    :CallSite(lvl, fl, ln, func), kind(knd), amount(amnt),
+     _interval(0 == amnt ? 0 : 1000000000ULL / amnt), _count(0), _suppressed(0) {}
+
+inline bool RateLimitedSite::allowed() const {
+    bool allow = false;
+
+    if (0 == amount) {
+        // nothing is let through
+    } else if (Every == kind) {
+        allow = _count.fetch_add(1, std::memory_order_relaxed) % amount == 0;
+    } else {
+        /*
+            _count is when the bucket will be full again.
+            A line takes one token, pushing that time out by _interval,
+            which is refused once it would be more than a second away.
+        */
+        const auto now = _now();
+        auto full = _count.load(std::memory_order_relaxed);
+
+        while (true) {
+            const auto next = std::max(full, now) + _interval;
+
+            if (next > now + 1000000000ULL) {
+                allow = false;
+                break;
+            }
+
+            if (_count.compare_exchange_weak(full, next, std::memory_order_relaxed)) {
+                allow = true;
+                break;
+            }
+        }
+    }
+
+    if (!allow) {
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return allow;
+}
+
+inline const char* RateLimitedSite::suppressedSummary() const {
+    static thread_local char summary[Number::BufferSize * 2];
+
+    if (!_summaries().load(std::memory_order_relaxed)) {
+        return "";
+    }
+
+    const auto suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+
+    if (0 == suppressed) {
+        return "";
+    }
+
+    const char prefix[] = "(suppressed ";
+    const char suffix[] = " repeats) ";
+    size_t size = sizeof(prefix) - 1;
+
+    ::memcpy(summary, prefix, size);
+    size += Number::write(summary + size, suppressed);
+    ::memcpy(summary + size, suffix, sizeof(suffix)); // includes the nul
+    return summary;
+}
+
+inline std::atomic<bool>& RateLimitedSite::_summaries() {
+    static std::atomic<bool> summaries(true);
+
+    return summaries;
+}
+
+inline uint64_t RateLimitedSite::_now() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+inline TraceSite::TraceSite(const char* flw, const char* expr, const char* fl, int ln, const char* func)
+    :flow(flw), expression(expr), _callsite(Trace, fl, ln, func), _taken(0), _notTaken(0),
+     _next(_first().load()) {
+    auto& head = _first();
+
+    while (!head.compare_exchange_weak(_next, this)) {
+        // _next was updated to the current first site, try again
+    }
+}
+
+inline bool TraceSite::evaluated(bool result) const {
+    if (_counted(result ? _taken : _notTaken)) {
+        Logger(_callsite).logExpressionBool(flow, expression, result);
+    }
+
+    return result;
+}
+
+template<typename T>
+inline T TraceSite::evaluated(T result) const {
+    if (_counted(_taken)) {
+        Logger(_callsite).logExpression(flow, expression, result);
+    }
+
+    return result;
+}
+
+inline uint64_t TraceSite::taken() const {
+    return _taken.load(std::memory_order_relaxed);
+}
+
+inline uint64_t TraceSite::notTaken() const {
+    return _notTaken.load(std::memory_order_relaxed);
+}
+
+inline const TraceSite* TraceSite::next() const {
+    return _next;
+}
+
+inline TimingSite::Stripe::Stripe()
+    :count(0), min(UINT64_MAX), max(0), buckets() {
+    for (auto& bucket : buckets) {
+        bucket.store(0);
+    }
+}
+
+inline TimingSite::TimingSite(Level lvl, const char* fl, int ln, const char* func, const char* nm)
+    :CallSite(lvl, fl, ln, func), name(nm), _stripes(), _next(_first().load()) {
+    auto& head = _first();
+
+    while (!head.compare_exchange_weak(_next, this)) {
+        // _next was updated to the current first site, try again
+    }
+}
+
+inline bool TimingSite::measured() const {
+    return _shown();
+}
+
+inline void TimingSite::record(uint64_t nanoseconds) const {
+    auto& stripe = _stripes[_stripe()];
+    auto least = stripe.min.load(std::memory_order_relaxed);
+    auto most = stripe.max.load(std::memory_order_relaxed);
+
+    stripe.count.fetch_add(1, std::memory_order_relaxed);
+    stripe.buckets[_bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+
+    while (nanoseconds < least && !stripe.min.compare_exchange_weak(least, nanoseconds, std::memory_order_relaxed)) {
+        // least was updated to the current minimum, try again
+    }
+
+    while (nanoseconds > most && !stripe.max.compare_exchange_weak(most, nanoseconds, std::memory_order_relaxed)) {
+        // most was updated to the current maximum, try again
+    }
+}
+
+inline TimingSummary TimingSite::take() const {
+    TimingSummary summary {name, file, line, function, level, 0, UINT64_MAX, 0, 0, 0};
+    uint64_t counts[Buckets] = {};
+
+    for (auto& stripe : _stripes) {
+        summary.count += stripe.count.exchange(0, std::memory_order_relaxed);
+        summary.min = std::min(summary.min, stripe.min.exchange(UINT64_MAX, std::memory_order_relaxed));
+        summary.max = std::max(summary.max, stripe.max.exchange(0, std::memory_order_relaxed));
+
+        for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+            counts[bucket] += stripe.buckets[bucket].exchange(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t total = 0;
+
+    for (const auto count : counts) {
+        total += count;
+    }
+
+    if (0 == total) {
+        summary.count = 0;
+        summary.min = 0;
+        return summary;
+    }
+
+    // a line recorded while we took is in the buckets but maybe not the count, so the buckets are used
+    const uint64_t p50 = (total + 1) / 2;
+    const uint64_t p99 = total - total / 100;
+    uint64_t seen = 0;
+
+    for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+        const auto before = seen;
+
+        seen += counts[bucket];
+
+        if (before < p50 && seen >= p50) {
+            summary.p50 = _bucketLimit(bucket);
+        }
+
+        if (before < p99 && seen >= p99) {
+            summary.p99 = _bucketLimit(bucket);
+        }
+    }
+
+    summary.count = total;
+    summary.min = std::min(summary.min, summary.max);
+    summary.p50 = std::min(std::max(summary.p50, summary.min), summary.max);
+    summary.p99 = std::min(std::max(summary.p99, summary.min), summary.max);
+    return summary;
+}
+
+inline const TimingSite* TimingSite::next() const {
+    return _next;
+}
+
+inline const TimingSite* TimingSite::first() {
+    return _first().load();
+}
+
+inline std::atomic<const TimingSite*>& TimingSite::_first() {
+    static std::atomic<const TimingSite*> first(nullptr);
+
+    return first;
+}
+
+inline size_t TimingSite::_stripe() {
+    static std::atomic<size_t> nextStripe(0);
+    static thread_local const size_t stripe = nextStripe.fetch_add(1) % Stripes;
+
+    return stripe;
+}
+
+inline size_t TimingSite::_bucket(uint64_t nanoseconds) {
+    if (nanoseconds < 4) {
+        return static_cast<size_t>(nanoseconds);
+    }
+
+    const auto highest = static_cast<size_t>(63 - __builtin_clzll(nanoseconds));
+
+    const auto quarter = static_cast<size_t>((nanoseconds >> (highest - 2)) & 3);
+
+    return std::min<size_t>(Buckets - 1, (highest - 1) * 4 + quarter);
+}
+
+inline uint64_t TimingSite::_bucketLimit(size_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    const auto highest = bucket / 4 + 1;
+    const auto quarter = static_cast<uint64_t>(bucket % 4);
+
+    return ((4 + quarter + 1) << (highest - 2)) - 1;
+}
+
+inline TimeScope::TimeScope(const TimingSite& site)
+    :_site(site), _measured(site.measured()),
+     _start(_measured ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {}
+
+inline TimeScope::~TimeScope() {
+    if (_measured) {
+        const auto elapsed = std::chrono::steady_clock::now() - _start;
+
+        _site.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+}
+
+inline const TraceSite* TraceSite::first() {
+    return _first().load();
+}
+
+inline std::atomic<const TraceSite*>& TraceSite::_first() {
+    static std::atomic<const TraceSite*> first(nullptr);
+
+    return first;
+}
+
+inline std::atomic<int>& TraceSite::_mode() {
+    static std::atomic<int> mode(Logger::TraceLines);
+
+    return mode;
+}
+
+inline std::atomic<uint64_t>& TraceSite::_sampleEvery() {
+    static std::atomic<uint64_t> sampleEvery(0);
+
+    return sampleEvery;
+}
+
+inline bool TraceSite::_counted(std::atomic<uint64_t>& counter) const {
+    if (Logger::TraceLines == _mode().load(std::memory_order_relaxed)) {
+        return _callsite.enabled();
+    }
+
+    counter.fetch_add(1, std::memory_order_relaxed);
+
+    const auto sampleEvery = _sampleEvery().load(std::memory_order_relaxed);
+
+    return 0 != sampleEvery && (taken() + notTaken()) % sampleEvery == 0 && _callsite.enabled();
+}
+
+inline StreamSink::StreamSink(FILE* stream, const std::string& name, CloseAction action) 
+    :_name(name), _stream(stream), _close(action == AutoClose) {}
+
+inline StreamSink::~StreamSink() {
+    if (_close && nullptr != _stream) {
+        if (::fclose(_stream) != 0) {
+            // too late
+        }
+    }
+}
+
+inline void StreamSink::log(const std::string&line) {
+    errno = 0;
+    const auto amount = ::fwrite(reinterpret_cast<const char *>(line.c_str()), 1, line.size(), _stream);
+    const auto error = errno;
+
+    if (::ferror(_stream)) {
+        _throwError(error);
+    }
+
+    if (amount < line.size()) {
+        throw std::runtime_error("Incomplete write to " + _name);
+    }
+}
+
+inline void StreamSink::logBatch(const Record* records, size_t count) {
+    /*
+        Anything buffered in the stream is written first to keep the lines in order,
+        then the batch goes straight to the file descriptor, MaxVectors lines per system call.
+    */
+    if (count == 1) {
+        log(records[0].line);
+        return;
+    }
+
+    if (::fflush(_stream) != 0) {
+        _throwError(errno);
+    }
+
+    const auto descriptor = ::fileno(_stream);
+    struct iovec vectors[MaxVectors];
+    size_t next = 0;
+
+    while (next < count) {
+        int used = 0;
+
+        for (; next < count && used < MaxVectors; ++next) {
+            if (!records[next].line.empty()) {
+                vectors[used].iov_base = const_cast<char*>(records[next].line.data());
+                vectors[used].iov_len = records[next].line.size();
+                used += 1;
+            }
+        }
+
+        struct iovec* remaining = vectors;
+
+        while (used > 0) {
+            const auto written = ::writev(descriptor, remaining, used);
+
+            if (written < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+
+                _throwError(errno);
+            }
+
+            auto amount = static_cast<size_t>(written);
+
+            while (used > 0 && amount >= remaining->iov_len) { // skip what was completely written
+                amount -= remaining->iov_len;
+                remaining += 1;
+                used -= 1;
+            }
+
+            if (used > 0) {
+                remaining->iov_base = static_cast<char*>(remaining->iov_base) + amount;
+                remaining->iov_len -= amount;
+            }
+        }
+    }
+}
+
+inline void StreamSink::_throwError(int error) {
+    throw std::system_error(
+        std::error_code(error, std::generic_category()),
+        "Failed to log to '" + _name + "': " + ::strerror(error)
+    );
+}
+
+inline StdErrSink::StdErrSink()
+    :StreamSink(stderr, "stderr", StreamSink::DoNotClose) {}
+
+inline StdOutSink::StdOutSink()
+    :StreamSink(stdout, "stdout", StreamSink::DoNotClose) {}
+
+inline FileSink::FileSink(const std::string& path)
+    :StreamSink(_open(path), path, StreamSink::AutoClose) {}
+
+inline FILE* FileSink::_open(const std::string& path) {
+    auto opened = ::fopen(path.c_str(), "a");
+
+    if (nullptr == opened) {
+        const auto error = errno;
+
+        throw std::system_error(
+            std::error_code(error, std::generic_category()),
+            "Failed to open log '" + path + "': " + ::strerror(error)
+        );
+    }
+
+    return opened;
+}
+
+inline BufferedFileSink::BufferedFileSink(const std::string& path, const Policy& policy)
+    :_path(path), _policy(policy), _file(_open(path)), _buffer(), _firstBuffered(), _lastSync(Clock::now()),
+     _unsynced(false) {
+    _buffer.reserve(policy.bufferBytes);
+}
+
+inline BufferedFileSink::~BufferedFileSink() {
+    try {
+        flush();
+    } catch(const std::exception&) {
+        // too late
+    }
+
+    ::close(_file);
+}
+
+inline void BufferedFileSink::log(const std::string& line) {
+    if (_buffer.empty()) {
+        _firstBuffered = Clock::now();
+    }
+
+    _buffer.append(line);
+    _flushIfNeeded(false);
+}
+
+inline void BufferedFileSink::logBatch(const Record* records, size_t count) {
+    /*
+        An empty batch means time has passed, so the time limits are checked.
+    */
+    bool urgent = false;
+
+    if (_buffer.empty() && count > 0) {
+        _firstBuffered = Clock::now();
+    }
+
+    for (size_t index = 0; index < count; ++index) {
+        _buffer.append(records[index].line);
+        urgent = urgent || records[index].level <= _policy.flushLevel;
+    }
+
+    _flushIfNeeded(urgent);
+}
+
+inline void BufferedFileSink::flush() {
+    if (!_buffer.empty()) {
+        _write();
+    }
+}
+
+inline void BufferedFileSink::sync() {
+    flush();
+
+    if (_unsynced) {
+#if defined(__APPLE__)
+        const auto result = ::fsync(_file);
+#else
+        const auto result = ::fdatasync(_file);
+#endif
+
+        if (result != 0) {
+            _throwError(errno);
+        }
+
+        _unsynced = false;
+        _lastSync = Clock::now();
+    }
+}
+
+inline void BufferedFileSink::_flushIfNeeded(bool urgent) {
+    const auto now = Clock::now();
+    const auto buffered = std::chrono::duration_cast<std::chrono::milliseconds>(now - _firstBuffered).count();
+    const auto sinceSync = std::chrono::duration_cast<std::chrono::seconds>(now - _lastSync).count();
+
+    if (!_buffer.empty() && (urgent || _buffer.size() >= _policy.bufferBytes
+                                    || buffered >= _policy.flushMilliseconds)) {
+        _write();
+    }
+
+    if (_unsynced && _policy.syncSeconds >= 0 && sinceSync >= _policy.syncSeconds) {
+        sync();
+    }
+}
+
+inline void BufferedFileSink::_write() {
+    size_t offset = 0;
+
+    while (offset < _buffer.size()) {
+        const auto written = ::write(_file, _buffer.data() + offset, _buffer.size() - offset);
+
+        if (written < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            const auto error = errno;
+
+            _buffer.erase(0, offset); // keep what was not written
+            _throwError(error);
+        }
+
+        offset += static_cast<size_t>(written);
+    }
+
+    _buffer.clear();
+    _unsynced = true;
+}
+
+inline void BufferedFileSink::_throwError(int error) {
+    throw std::system_error(
+        std::error_code(error, std::generic_category()),
+        "Failed to log to '" + _path + "': " + ::strerror(error)
+    );
+}
+
+inline int BufferedFileSink::_open(const std::string& path) {
+    const auto opened = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (opened < 0) {
+        const auto error = errno;
+
+        throw std::system_error(
+            std::error_code(error, std::generic_category()),
+            "Failed to open log '" + path + "': " + ::strerror(error)
+        );
+    }
+
+    return opened;
+}
+
+inline MappedFileSink::MappedFileSink(const std::string& path, size_t segmentBytes)
+    :_path(path), _segmentBytes(std::max(segmentBytes, static_cast<size_t>(HeaderSize) + 1)), _index(0),
+     _segmentPath(), _file(-1), _map(nullptr), _mapped(0), _committed(0) {
+    struct stat info;
+
+    while (::stat(_name(_path, _index).c_str(), &info) == 0) {
+        _index += 1; // never overwrite the segments of an earlier run
+    }
+
+    _openSegment(_segmentBytes);
+}
+
+inline MappedFileSink::~MappedFileSink() {
+    try {
+        _closeSegment();
+    } catch(const std::exception&) {
+        // too late
+    }
+}
+
+inline void MappedFileSink::log(const std::string& line) {
+    if (HeaderSize + _committed + line.size() > _mapped) {
+        _closeSegment();
+        _index += 1;
+        _openSegment(std::max(_segmentBytes, HeaderSize + line.size()));
+    }
+
+    ::memcpy(_map + HeaderSize + _committed, line.data(), line.size());
+    _committed += line.size();
+    std::atomic_signal_fence(std::memory_order_release); // the line is in place before it is committed
+    ::memcpy(_map + CommittedOffset, &_committed, sizeof(_committed));
+}
+
+inline void MappedFileSink::sync() {
+    if (nullptr != _map && ::msync(_map, _mapped, MS_SYNC) != 0) {
+        _throwError("sync", errno);
+    }
+}
+
+inline const std::string& MappedFileSink::segmentPath() const {
+    return _segmentPath;
+}
+
+inline std::string MappedFileSink::read(const std::string& segmentPath) {
+    char header[HeaderSize];
+    uint64_t committed = 0;
+    std::string lines;
+    const auto file = ::fopen(segmentPath.c_str(), "rb");
+
+    if (nullptr == file) {
+        const auto error = errno;
+
+        throw SystemError(std::error_code(error, std::generic_category()),
+                          "Failed to open segment '" + segmentPath + "': " + ::strerror(error));
+    }
+
+    const auto headerRead = ::fread(header, 1, sizeof(header), file);
+
+    if (headerRead != sizeof(header) || ::memcmp(header, magic(), MagicSize) != 0) {
+        ::fclose(file);
+        throw std::runtime_error("Not a yalo segment: " + segmentPath);
+    }
+
+    ::memcpy(&committed, header + CommittedOffset, sizeof(committed));
+    lines.assign(static_cast<size_t>(committed), '\0');
+
+    const auto amount = committed == 0 ? 0 : ::fread(&lines[0], 1, lines.size(), file);
+
+    ::fclose(file);
+    lines.resize(amount);
+    return lines;
+}
+
+inline const char* MappedFileSink::magic() {
+    return "yaloseg1";
+}
+
+inline void MappedFileSink::_openSegment(size_t minimum) {
+    const auto path = _name(_path, _index);
+    const auto file = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    const auto size = static_cast<off_t>(minimum);
+
+    if (file < 0) {
+        _throwError("open", errno);
+    }
+
+#if defined(__linux__)
+    const auto allocated = ::posix_fallocate(file, 0, size); // reserve the blocks up front
+#else
+    const auto allocated = ::ftruncate(file, size) == 0 ? 0 : errno;
+#endif
+    void* map = 0 == allocated ? ::mmap(nullptr, minimum, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+
+    if (MAP_FAILED == map) {
+        const auto error = 0 == allocated ? errno : allocated;
+
+        ::close(file);
+        ::unlink(path.c_str());
+        _throwError("map", error);
+    }
+
+    const uint64_t capacity = minimum - HeaderSize;
+
+    _file = file;
+    _map = static_cast<char*>(map);
+    _mapped = minimum;
+    _committed = 0;
+    _segmentPath = path;
+    ::memset(_map, 0, HeaderSize);
+    ::memcpy(_map, magic(), MagicSize);
+    ::memcpy(_map + CapacityOffset, &capacity, sizeof(capacity));
+}
+
+inline void MappedFileSink::_closeSegment() {
+    if (nullptr == _map) {
+        return;
+    }
+
+    ::munmap(_map, _mapped);
+    _map = nullptr;
+
+    const auto truncated = ::ftruncate(_file, static_cast<off_t>(HeaderSize + _committed));
+    const auto error = errno;
+
+    ::close(_file);
+    _file = -1;
+
+    if (truncated != 0) {
+        _throwError("truncate", error);
+    }
+}
+
+inline void MappedFileSink::_throwError(const std::string& action, int error) {
+    throw SystemError(std::error_code(error, std::generic_category()),
+                      "Failed to " + action + " segment of '" + _path + "': " + ::strerror(error));
+}
+
+inline std::string MappedFileSink::_name(const std::string& path, size_t index) {
+    char suffix[Number::BufferSize];
+    const auto digits = Number::write(suffix, index);
+
+    return path + "." + std::string(digits < 6 ? 6 - digits : 0, '0') + std::string(suffix, digits);
+}
+
+inline RotatingFileSink::RotatingFileSink(const std::string& path, const Policy& policy)
+    :_path(path), _policy(policy), _file(new FileSink(path)), _size(_fileSize(path)), _nextRotation(_next(::time(nullptr))),
+     _retryAt(0), _rotations(0), _thread(), _mutex(), _changed(), _pending(), _busy(false), _stopping(false) {}
+
+inline RotatingFileSink::~RotatingFileSink() {
+    if (_thread.joinable()) {
+        {
+            Logger::Lock lock(_mutex);
+
+            _stopping = true;
+        }
+
+        _changed.notify_all();
+        _thread.join(); // finishes everything pending first
+    }
+}
+
+inline void RotatingFileSink::log(const std::string& line) {
+    const auto full = _policy.maxBytes > 0 && _size > 0 && _size + line.size() > _policy.maxBytes;
+    const auto late = _policy.intervalSeconds > 0 && ::time(nullptr) >= _nextRotation;
+
+    if (full || late) {
+        rotate();
+    }
+
+    _file->log(line);
+    _size += line.size();
+}
+
+inline void RotatingFileSink::rotate() {
+    const auto now = ::time(nullptr);
+
+    if (now < _retryAt) {
+        return;
+    }
+
+    const auto rolledOver = _path + ".rotating." + std::to_string(++_rotations);
+    const auto renamed = ::rename(_path.c_str(), rolledOver.c_str()) == 0; // the open handle follows the file
+    const auto error = errno;
+    std::unique_ptr<FileSink> reopened;
+
+    _nextRotation = _next(now);
+
+    if (!renamed && ENOENT != error) {
+        throw std::system_error(std::error_code(error, std::generic_category()),
+                                "Failed to roll over '" + _path + "': " + ::strerror(error));
+    }
+
+    try {
+        reopened.reset(new FileSink(_path));
+    } catch (const std::system_error&) {
+        if (renamed) {
+            ::rename(rolledOver.c_str(), _path.c_str());
+        }
+
+        _retryAt = now + 1; // dropping the sink would lose every line, so rotating is tried again later
+        return;
+    }
+
+    _file.swap(reopened);
+    reopened.reset(); // the rest of the rolled over file is written before it is handed to the thread
+    _size = _fileSize(_path);
+    _retryAt = 0;
+
+    if (!renamed) {
+        return; // nothing had been logged
+    }
+
+    Logger::Lock lock(_mutex);
+
+    _pending.push_back(rolledOver);
+
+    if (!_thread.joinable()) {
+        _thread = std::thread(&RotatingFileSink::_run, this);
+    }
+
+    _changed.notify_all();
+}
+
+inline void RotatingFileSink::waitForRotations() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_pending.empty() || _busy) {
+        _changed.wait(lock);
+    }
+}
+
+inline RotatingFileSink::Policy RotatingFileSink::policy(const std::string& options) {
+    std::istringstream words(options);
+    std::string word;
+    Policy result;
+
+    while (words >> word) {
+        const auto equals = word.find('=');
+        const auto name = word.substr(0, equals);
+        const auto value = equals == std::string::npos ? std::string() : word.substr(equals + 1);
+
+        if (name == "maxBytes") {
+            result.maxBytes = _bytes(word, value);
+        } else if (name == "intervalSeconds") {
+            const auto seconds = _count(word, value);
+
+            if (seconds > static_cast<size_t>(std::numeric_limits<int>::max())) {
+                throw std::invalid_argument("Rotation option is too large: " + word);
+            }
+
+            result.intervalSeconds = static_cast<int>(seconds);
+        } else if (name == "generations") {
+            result.generations = _count(word, value);
+        } else if (name == "compression" && (value == "none" || value == "gzip" || value == "zstd")) {
+            result.compression = value == "gzip" ? Gzip : value == "zstd" ? Zstd : NoCompression;
+        } else if (name == "compression") {
+            throw std::invalid_argument("Rotation compression must be none, gzip, or zstd: " + word);
+        } else {
+            throw std::invalid_argument("Unknown rotation option: " + word);
+        }
+    }
+
+    return result;
+}
+
+inline void RotatingFileSink::_run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        if (_pending.empty()) {
+            if (_stopping) {
+                break;
+            }
+
+            _changed.wait(lock);
+            continue;
+        }
+
+        const auto rolledOver = _pending.front();
+
+        _pending.erase(_pending.begin());
+        _busy = true;
+        lock.unlock();
+        _shift(rolledOver);
+        lock.lock();
+        _busy = false;
+        _changed.notify_all();
+    }
+}
+
+inline void RotatingFileSink::_shift(const std::string& rolledOver) {
+    /*
+        A generation might not be compressed (compression failed or was turned on later),
+        so each extension is renamed.
+    */
+    const char* const extensions[] = {"", ".gz", ".zst"};
+
+    for (size_t index = std::max(_policy.generations, static_cast<size_t>(1)); index > 0; --index) {
+        for (const auto extension : extensions) {
+            const auto from = _generation(index, extension);
+
+            if (index >= _policy.generations) {
+                ::remove(from.c_str());
+            } else {
+                ::rename(from.c_str(), _generation(index + 1, extension).c_str());
+            }
+        }
+    }
+
+    if (0 == _policy.generations) {
+        ::remove(rolledOver.c_str());
+        return;
+    }
+
+    const auto first = _generation(1, "");
+
+    if (::rename(rolledOver.c_str(), first.c_str()) == 0) {
+        _compress(first);
+    }
+}
+
+inline void RotatingFileSink::_compress(const std::string& path) {
+    static char* const noEnvironment[] = {nullptr};
+    const char* gzip[] = {"gzip", "-f", "-q", path.c_str(), nullptr};
+    const char* zstd[] = {"zstd", "-f", "-q", "--rm", path.c_str(), nullptr};
+    const char** arguments = Gzip == _policy.compression ? gzip : zstd;
+    pid_t child = 0;
+    int status = 0;
+
+    if (NoCompression == _policy.compression) {
+        return;
+    }
+
+    if (::posix_spawnp(&child, arguments[0], nullptr, nullptr, const_cast<char* const*>(arguments),
+                       noEnvironment) == 0) {
+        while (::waitpid(child, &status, 0) < 0 && EINTR == errno) {
+            // keep waiting
+        }
+    }
+
+    // if compression failed the generation is kept uncompressed
+}
+
+inline std::string RotatingFileSink::_generation(size_t index, const char* extension) const {
+    return _path + "." + std::to_string(index) + extension;
+}
+
+inline time_t RotatingFileSink::_next(time_t now) const {
+    if (_policy.intervalSeconds <= 0) {
+        return 0;
+    }
+
+    return (now / _policy.intervalSeconds + 1) * _policy.intervalSeconds; // on the clock, like every hour on the hour
+}
+
+inline size_t RotatingFileSink::_fileSize(const std::string& path) {
+    struct stat info;
+
+    return ::stat(path.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+}
+
+inline size_t RotatingFileSink::_bytes(const std::string& option, const std::string& value) {
+    const auto last = value.empty() ? '\0' : value[value.size() - 1];
+    const size_t unit = 'k' == last || 'K' == last ? 1024
+                      : 'm' == last || 'M' == last ? 1024 * 1024
+                      : 'g' == last || 'G' == last ? 1024 * 1024 * 1024 : 1;
+    const auto number = _count(option, 1 == unit ? value : value.substr(0, value.size() - 1));
+
+    if (number > std::numeric_limits<size_t>::max() / unit) {
+        throw std::invalid_argument("Rotation option is too large: " + option);
+    }
+
+    return number * unit;
+}
+
+inline size_t RotatingFileSink::_count(const std::string& option, const std::string& value) {
+    char* end = nullptr;
+
+    errno = 0;
+
+    const auto number = std::strtoull(value.c_str(), &end, 10);
+
+    if (value.empty() || value[0] < '0' || value[0] > '9' || '\0' != *end) {
+        throw std::invalid_argument("Rotation option is not a number: " + option);
+    }
+
+    if (ERANGE == errno || number > std::numeric_limits<size_t>::max()) {
+        throw std::invalid_argument("Rotation option is too large: " + option);
+    }
+
+    return static_cast<size_t>(number);
+}
+
+inline void SyslogSink::log(const std::string& line) {
+    syslog(LOG_NOTICE, "%s", line.c_str());
+}
+
+inline void SyslogSink::logBatch(const Record* records, size_t count) {
+    for (size_t index = 0; index < count; ++index) {
+        syslog(severity(records[index].level), "%s", records[index].line.c_str());
+    }
+}
+
+inline int SyslogSink::severity(Level level) {
+    switch (level) {
+        case Fatal:
+            return LOG_CRIT;
+        case Log:
+            return LOG_NOTICE;
+        case Error:
+            return LOG_ERR;
+        case Warning:
+            return LOG_WARNING;
+        case Info:
+            return LOG_INFO;
+        case Debug:
+        case Verbose:
+        case Trace:
+        default:
+            return LOG_DEBUG;
+    }
+}
+
+inline SyslogSocketSink::SyslogSocketSink(const Policy& policy)
+    :_policy(policy), _host(_hostName()), _identity(policy.identity.empty() ? _programName() : policy.identity),
+     _socket(-1), _pending(std::max<size_t>(1, policy.pendingLines)), _head(0), _size(0), _dropped(0) {
+    _connect(); // the daemon may not be up yet, we try again when sending
+}
+
+inline SyslogSocketSink::~SyslogSocketSink() {
+    _send();
+
+    if (_socket >= 0) {
+        ::close(_socket);
+    }
+}
+
+inline void SyslogSocketSink::log(const std::string& line) {
+    char timestamp[64];
+
+    _timestamp(timestamp, sizeof(timestamp));
+    _queue(Log, line.data(), line.size(), timestamp);
+    _send();
+}
+
+inline void SyslogSocketSink::logBatch(const Record* records, size_t count) {
+    char timestamp[64];
+
+    _timestamp(timestamp, sizeof(timestamp)); // one clock read for the batch
+
+    for (size_t index = 0; index < count; ++index) {
+        _queue(records[index].level, records[index].line.data(), records[index].line.size(), timestamp);
+    }
+
+    _send(); // an empty batch retries what is pending
+}
+
+inline size_t SyslogSocketSink::dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+inline size_t SyslogSocketSink::pending() const {
+    return _size.load(std::memory_order_relaxed);
+}
+
+inline void SyslogSocketSink::_queue(Level level, const char* line, size_t size, const char* timestamp) {
+    const auto queued = _size.load(std::memory_order_relaxed);
+
+    if (queued == _pending.size()) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
-    if (_doLog && levelRequested == Fatal) {
-        ::abort();
+    auto& datagram = _pending[(_head + queued) % _pending.size()];
+    const auto priority = std::to_string((_policy.facility & LOG_FACMASK) | SyslogSink::severity(level));
+
+    while (size > 0 && (line[size - 1] == '\n' || line[size - 1] == '\r')) {
+        --size;
     }
-}
 
-inline Logger& Logger::log_line(const std::string& logLine) {
-    _settingsFile(); // check for dynamic changes
+    datagram.clear();
 
-    if (!shown(levelRequested, file)) {
-        return *this;
+    if (Journald == _policy.protocol) {
+        /*
+            Journald native fields, a message with a new line in it is sent
+            as the field name, a new line, and a little endian 64 bit length.
+        */
+        datagram.append("PRIORITY=").append(std::to_string(SyslogSink::severity(level)));
+        datagram.append("\nSYSLOG_FACILITY=").append(std::to_string(LOG_FAC(_policy.facility & LOG_FACMASK)));
+        datagram.append("\nSYSLOG_IDENTIFIER=").append(_identity);
+
+        if (nullptr == ::memchr(line, '\n', size)) {
+            datagram.append("\nMESSAGE=").append(line, size);
+        } else {
+            datagram.append("\nMESSAGE\n");
+
+            for (int byte = 0; byte < 8; ++byte) {
+                datagram.append(1, static_cast<char>((static_cast<uint64_t>(size) >> (8 * byte)) & 0xFF));
+            }
+
+            datagram.append(line, size);
+        }
+
+        datagram.append(1, '\n');
+    } else {
+        // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+        datagram.append(1, '<').append(priority).append(">1 ").append(timestamp);
+        datagram.append(1, ' ').append(_host).append(1, ' ').append(_identity);
+        datagram.append(1, ' ').append(std::to_string(::getpid())).append(" - - ");
+        datagram.append(line, size);
     }
 
-    return _logLineCore(logLine);
+    _size.store(queued + 1, std::memory_order_relaxed);
 }
 
-template<typename T>
-inline T Logger::logExpression(const std::string& flow, const std::string& expression, T result) {
-    log_line(flow + ": " + expression + " => " + std::to_string(result));
-    return result;
-}
+inline void SyslogSocketSink::_send() {
+    bool reconnected = false;
 
-inline bool Logger::logExpressionBool(const std::string& flow, const std::string& expression, bool result) {
-    log_line(flow + ": " + expression + " => " + (result ? "true" : "false"));
-    return result;
-}
+    while (_size.load(std::memory_order_relaxed) > 0) {
+        const auto queued = _size.load(std::memory_order_relaxed);
+        const auto batch = std::min<size_t>(queued, MaxBatch);
+        ssize_t sent = -1;
 
-template<typename T, typename>
-inline Logger& Logger::operator<<(T value) {
-    return _append(std::to_string(value));
+        if (_socket >= 0) {
+#if defined(__linux__)
+            struct iovec vectors[MaxBatch];
+            struct mmsghdr messages[MaxBatch];
+
+            ::memset(messages, 0, sizeof(messages));
+
+            for (size_t index = 0; index < batch; ++index) {
+                auto& datagram = _pending[(_head + index) % _pending.size()];
+
+                vectors[index].iov_base = &datagram[0];
+                vectors[index].iov_len = datagram.size();
+                messages[index].msg_hdr.msg_iov = &vectors[index];
+                messages[index].msg_hdr.msg_iovlen = 1;
+            }
+
+            sent = ::sendmmsg(_socket, messages, static_cast<unsigned int>(batch), MSG_DONTWAIT);
+#else
+            const auto& datagram = _pending[_head];
+
+            sent = ::send(_socket, datagram.data(), datagram.size(), MSG_DONTWAIT) < 0 ? -1 : 1;
+#endif
+        }
+
+        if (sent > 0) {
+            _head = (_head + static_cast<size_t>(sent)) % _pending.size();
+            _size.store(queued - static_cast<size_t>(sent), std::memory_order_relaxed);
+            continue;
+        }
+
+        const auto error = _socket >= 0 ? errno : ENOTCONN;
+
+        if (EINTR == error) {
+            continue;
+        }
+
+        if (EAGAIN == error || EWOULDBLOCK == error || ENOBUFS == error) {
+            return; // the daemon is behind, keep what is pending for the next write
+        }
+
+        if ((ENOTCONN == error || ECONNREFUSED == error || ENOENT == error || EPIPE == error) && !reconnected) {
+            reconnected = true;
+
+            if (_connect()) {
+                continue;
+            }
+        }
+
+        if (ENOTCONN == error || ECONNREFUSED == error || ENOENT == error || EPIPE == error) {
+            return; // the daemon is gone, keep what is pending until it is back
+        }
+
+        // this datagram can never be sent (too large, ...)
+        _head = (_head + 1) % _pending.size();
+        _size.store(queued - 1, std::memory_order_relaxed);
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-inline Logger& Logger::operator<<(const std::string& str) {
-    return _append(str);
+inline bool SyslogSocketSink::_connect() {
+    struct sockaddr_un address;
+
+    if (_socket >= 0) {
+        ::close(_socket);
+        _socket = -1;
+    }
+
+    if (_policy.path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+
+    ::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    ::memcpy(address.sun_path, _policy.path.c_str(), _policy.path.size() + 1);
+
+    const auto opened = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    if (opened < 0) {
+        return false;
+    }
+
+    ::fcntl(opened, F_SETFD, FD_CLOEXEC);
+    ::fcntl(opened, F_SETFL, ::fcntl(opened, F_GETFL) | O_NONBLOCK);
+
+    if (::connect(opened, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(opened);
+        return false;
+    }
+
+    _socket = opened;
+    return true;
 }
 
-inline Logger& Logger::operator<<(const char* str) {
-    return _append(str);
+inline std::string SyslogSocketSink::_hostName() {
+    char name[256];
+
+    if (::gethostname(name, sizeof(name)) != 0 || name[0] == '\0') {
+        return "-";
+    }
+
+    name[sizeof(name) - 1] = '\0';
+    return name;
 }
 
-inline Logger& Logger::operator<<(const void* ptr) {
-    std::ostringstream oss;
+inline std::string SyslogSocketSink::_programName() {
+#if defined(__APPLE__)
+    const char* name = ::getprogname();
+#elif defined(__linux__)
+    const char* name = program_invocation_short_name;
+#else
+    const char* name = nullptr;
+#endif
 
-    oss << std::showbase << std::uppercase << std::hex << ptr;
-    return _append(oss.str());
+    return nullptr == name || name[0] == '\0' ? "-" : name;
 }
 
-inline Logger& Logger::operator<<(float value) {
-    return (*this) << static_cast<double>(value);
+inline void SyslogSocketSink::_timestamp(char* buffer, size_t size) {
+    const auto now = std::chrono::system_clock::now();
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    const auto seconds = static_cast<time_t>(micros / 1000000);
+    struct tm parts;
+    char date[32];
+
+    ::gmtime_r(&seconds, &parts);
+    ::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &parts);
+    ::snprintf(buffer, size, "%s.%06dZ", date, static_cast<int>(micros % 1000000));
 }
 
-inline Logger& Logger::operator<<(double value) {
-    std::ostringstream oss;
+inline NetworkSink::NetworkSink(const std::string& url, const Policy& policy)
+    :_policy(policy), _udp(false), _host(), _port(), _socket(-1), _outgoing(), _offset(0), _mutex(), _changed(),
+     _incoming(), _stopping(false), _spooled(0), _dropped(0), _connects(0), _thread() {
+    const auto scheme = url.find("://");
+    const auto hostStart = std::string::npos == scheme ? std::string::npos : scheme + 3;
+    const auto colon = url.rfind(':');
 
-    oss << value;
-    return _append(oss.str());
-}
+    if (!isUrl(url) || colon <= hostStart || colon + 1 == url.size()) {
+        throw std::invalid_argument("Network sink must be tcp://host:port or udp://host:port: " + url);
+    }
 
-inline Logger& Logger::operator<<(const std::exception& exception) {
-    return _append(_formatter()->format(exception));
+    _udp = url.compare(0, scheme, "udp") == 0;
+    _host = url.substr(hostStart, colon - hostStart);
+    _port = url.substr(colon + 1);
+
+    if (_host.size() > 2 && _host.front() == '[' && _host.back() == ']') {
+        _host = _host.substr(1, _host.size() - 2); // [::1]
+    }
+
+    _thread = std::thread(&NetworkSink::_run, this);
 }
 
-inline std::mutex& Logger::_mutex(Mutex mutexType) {
-    static std::mutex sinkList;
-    static std::mutex threadList;
-    static std::mutex formatterMutex;
-    static std::mutex levelsMutex;
-    static std::mutex settingsMutex;
+inline NetworkSink::~NetworkSink() {
+    {
+        Logger::Lock lock(_mutex);
 
-    switch(mutexType) {
-        case ThreadListMutex:
-            return threadList;
-        case SinkListMutex:
-            return sinkList;
-        case FormatterMutex:
-            return formatterMutex;
-        case LevelsMutex:
-            return levelsMutex;
-        case SettingsMutex:
-            return settingsMutex;
-        default:
-            throw std::invalid_argument("mutexType is invalid: " 
-                + std::to_string(static_cast<int>(mutexType)));
+        _stopping = true; // under the lock, or the writer could miss the wakeup between its check and its wait
     }
+
+    _changed.notify_all();
+    _thread.join();
+    _disconnect();
 }
 
-inline size_t Logger::_threadIndex() {
-    static ThreadList threads;
-    const auto this_thread = std::this_thread::get_id();
-    Lock protection(_mutex(ThreadListMutex));
-    const auto found = std::find(threads.begin(), threads.end(), this_thread);
+inline void NetworkSink::log(const std::string& line) {
+    {
+        Logger::Lock lock(_mutex);
 
-    if (found == threads.end()) {
-        threads.push_back(this_thread);
-        return threads.size() - 1;
+        _append(line.data(), line.size());
     }
 
-    return static_cast<size_t>(found - threads.begin());
+    _changed.notify_all();
 }
 
-inline Logger::FileLevels& Logger::_levelsNeedsLock() {
-    static FileLevels levels;
+inline void NetworkSink::logBatch(const Record* records, size_t count) {
+    if (0 == count) {
+        return;
+    }
+
+    {
+        Logger::Lock lock(_mutex);
 
-    if (levels.size() == 0) {
-        levels[Error] = "";
+        for (size_t index = 0; index < count; ++index) {
+            _append(records[index].line.data(), records[index].line.size());
+        }
     }
 
-    return levels;
+    _changed.notify_all();
 }
 
-inline Logger::SinkList& Logger::_sinksNeedsLock() {
-    static SinkList sinks;
+inline bool NetworkSink::waitUntilSent(int milliseconds) {
+    std::unique_lock<std::mutex> lock(_mutex);
 
-    return sinks;
+    return _changed.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() {return 0 == _spooled.load();});
 }
 
-inline Logger& Logger::_append(const std::string& value) {
-    if (InserterPad == _spacing(InserterPad, NoChange) && !_stream.empty()) {
-        _stream += ' ';
-    }
+inline size_t NetworkSink::dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
 
-    _stream += value;
-    return *this;
+inline size_t NetworkSink::spooled() const {
+    return _spooled.load(std::memory_order_relaxed);
 }
 
-inline Logger& Logger::_logLineCore(const std::string& logLine) {
-    typedef std::pair<std::string, std::string> ExceptionLogger;
-    typedef std::vector<ExceptionLogger> ExceptionList;
-    ExceptionList failed_sinks;
-    Lock lock(_mutex(SinkListMutex));
-    auto& sinks = _sinksNeedsLock();
-    const auto formatted_line = _formatter()->format(logLine, _threadIndex(), *this);
+inline size_t NetworkSink::connects() const {
+    return _connects.load(std::memory_order_relaxed);
+}
+
+inline bool NetworkSink::isUrl(const std::string& text) {
+    return text.compare(0, 6, "tcp://") == 0 || text.compare(0, 6, "udp://") == 0;
+}
 
-    if (sinks.empty()) {
-        sinks.push_back(std::unique_ptr<StdErrSink>(new StdErrSink()));
+inline void NetworkSink::_append(const char* line, size_t size) {
+    if (_spooled.load(std::memory_order_relaxed) + size > _policy.spoolBytes) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
-    for (auto sink = sinks.begin(); sink != sinks.end(); ) {
-        try {
-            (*sink)->log(formatted_line);
-            ++sink;
-        } catch (const std::exception& exception) {
-            #pragma GCC diagnostic push
-            #pragma GCC diagnostic ignored "-Wpotentially-evaluated-expression"
-            const auto loggerType = *sink ? typeid(**sink).name() : "";
-            #pragma GCC diagnostic pop
+    _incoming.append(line, size);
+    _spooled.fetch_add(size, std::memory_order_relaxed);
+}
+
+inline void NetworkSink::_run() {
+    auto backoff = _policy.reconnectMilliseconds;
+    auto lingerUntil = std::chrono::steady_clock::time_point::max();
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _changed.wait(lock, [this]() {return _stopping || !_incoming.empty() || _offset < _outgoing.size();});
+
+            if (_offset == _outgoing.size()) {
+                // swapping keeps both buffers' capacity, so steady state does not allocate
+                _outgoing.clear();
+                _offset = 0;
+                _outgoing.swap(_incoming);
+            }
+
+            if (_stopping && lingerUntil == std::chrono::steady_clock::time_point::max()) {
+                lingerUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(_policy.lingerMilliseconds);
+            }
+
+            if (_stopping && (_outgoing.empty() || std::chrono::steady_clock::now() >= lingerUntil)) {
+                return;
+            }
+        }
+
+        if (_socket < 0 && !_connect()) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto wait = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+
+            wait = std::min(wait, lingerUntil);
+            _changed.wait_until(lock, wait, [this, &lingerUntil]() {
+                return _stopping && lingerUntil == std::chrono::steady_clock::time_point::max();
+            });
+            backoff = std::min(backoff * 2, _policy.maxReconnectMilliseconds);
+            continue;
+        }
 
-            failed_sinks.push_back(ExceptionLogger(_formatter()->format(exception), loggerType));
-            sink = sinks.erase(sink);
+        backoff = _policy.reconnectMilliseconds;
+
+        if (!(_udp ? _sendDatagram() : _send())) {
+            _disconnect();
         }
+
+        _changed.notify_all(); // for waitUntilSent()
     }
+}
+
+inline bool NetworkSink::_connect() {
+    struct addrinfo hints;
+    struct addrinfo* addresses = nullptr;
 
-    if (sinks.empty()) {
-        sinks.push_back(std::unique_ptr<StdErrSink>(new StdErrSink()));
+    ::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = _udp ? SOCK_DGRAM : SOCK_STREAM;
+
+    if (::getaddrinfo(_host.c_str(), _port.c_str(), &hints, &addresses) != 0) {
+        return false;
     }
 
-    if (!failed_sinks.empty()) {
-        for (const auto& exceptionLogger : failed_sinks) {
-            for (auto& sink : sinks) {
-                try {
-                    sink->log(_formatter()->format("Logger[" + exceptionLogger.second + "]: " 
-                                                    + exceptionLogger.first, 
-                                                    _threadIndex(), *this));
-                } catch(const std::exception&) {
-                    // we tried
-                }
-            }
+    for (auto address = addresses; nullptr != address && _socket < 0 && !_stopping; address = address->ai_next) {
+        _socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+        if (_socket < 0) {
+            continue;
+        }
+
+        ::fcntl(_socket, F_SETFD, FD_CLOEXEC);
+        ::fcntl(_socket, F_SETFL, ::fcntl(_socket, F_GETFL) | O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+        const int noSignal = 1;
+
+        ::setsockopt(_socket, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+
+        auto connected = ::connect(_socket, address->ai_addr, address->ai_addrlen) == 0;
+
+        if (!connected && EINPROGRESS == errno && _wait(POLLOUT, _policy.connectTimeoutMilliseconds)) {
+            int error = 0;
+            socklen_t size = sizeof(error);
+
+            connected = ::getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &size) == 0 && 0 == error;
+        }
+
+        if (!connected) {
+            _disconnect();
         }
     }
 
-    return *this;
-}
+    ::freeaddrinfo(addresses);
 
-inline Logger::IFormatterPtr& Logger::_formatter(IFormatterPtr update) {
-    static IFormatterPtr formatter;
-    Lock protection(_mutex(FormatterMutex));
+    if (_socket < 0) {
+        return false;
+    }
 
-    if (update) {
-        formatter = std::move(update);
-    } else if (!formatter) {
-        formatter = std::unique_ptr<DefaultFormatter>(new DefaultFormatter());
+    if (!_udp) {
+        const int noDelay = 1; // we already send in large batches
+
+        ::setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        // a line cut off by the last connection is sent again whole
+        const auto lineStart = 0 == _offset ? std::string::npos : _outgoing.rfind('\n', _offset - 1);
+        const auto resend = std::string::npos == lineStart ? 0 : lineStart + 1;
+
+        _spooled.fetch_add(_offset - resend, std::memory_order_relaxed);
+        _offset = resend;
     }
 
-    return formatter;
+    _connects.fetch_add(1, std::memory_order_relaxed);
+    return true;
 }
 
-inline Logger::IFormatterPtr& Logger::_formatter() {
-    return _formatter(nullptr);
-}
+inline bool NetworkSink::_send() {
+    while (_offset < _outgoing.size()) {
+        if (!_wait(POLLOUT, 100)) {
+            return true; // still connected, the caller decides whether to keep waiting
+        }
 
-inline Logger::InserterSpacing Logger::_spacing(InserterSpacing next, Action action) {
-    static InserterSpacing spacing=InserterPad;
+        const auto size = std::min(_outgoing.size() - _offset, _policy.batchBytes);
+#if defined(MSG_NOSIGNAL)
+        const auto sent = ::send(_socket, _outgoing.data() + _offset, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        const auto sent = ::send(_socket, _outgoing.data() + _offset, size, MSG_DONTWAIT);
+#endif
 
-    if (Change == action) {
-        spacing = next;
+        if (sent < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) {
+                continue;
+            }
+
+            return false;
+        }
+
+        _offset += static_cast<size_t>(sent);
+        _spooled.fetch_sub(static_cast<size_t>(sent), std::memory_order_relaxed);
     }
 
-    return spacing;
+    return true;
 }
 
-inline void Logger::_settingsFile(const std::string& newPath, int checkIntervalSeconds) {
-    std::string contents = _settingsContents(newPath, checkIntervalSeconds);
-    size_t start = 0;
+inline bool NetworkSink::_sendDatagram() {
+    while (_offset < _outgoing.size()) {
+        // as many whole lines as fit, or one line by itself if it is longer than a datagram
+        const auto limit = std::min(_outgoing.size(), _offset + _policy.datagramBytes);
+        auto end = limit == _outgoing.size() ? limit : _outgoing.rfind('\n', limit - 1);
+
+        if (std::string::npos == end || end < _offset) {
+            end = _outgoing.find('\n', _offset);
+        }
 
-    if (!newPath.empty()) {
-        Logger(Log)._logLineCore("New Settings File: " + newPath);
+        end = std::string::npos == end ? _outgoing.size() : std::min(end + 1, _outgoing.size());
+
+        const auto size = end - _offset;
+        const auto sent = ::send(_socket, _outgoing.data() + _offset, size, MSG_DONTWAIT);
+
+        if (sent < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || ENOBUFS == errno || EINTR == errno)) {
+            if (!_wait(POLLOUT, 100)) {
+                return true; // try again once there is room
+            }
+
+            continue;
+        }
+
+        if (sent < 0) {
+            // a datagram is sent whole or not at all, so its lines are dropped
+            const auto lines = std::count(_outgoing.begin() + static_cast<std::ptrdiff_t>(_offset),
+                                          _outgoing.begin() + static_cast<std::ptrdiff_t>(end), '\n');
+
+            _dropped.fetch_add(std::max<size_t>(1, static_cast<size_t>(lines)), std::memory_order_relaxed);
+        }
+
+        _offset = end;
+        _spooled.fetch_sub(size, std::memory_order_relaxed);
     }
 
-    if (contents.empty()) {
-        return; // no need to process
+    return true;
+}
+
+inline void NetworkSink::_disconnect() {
+    if (_socket >= 0) {
+        ::close(_socket);
+        _socket = -1;
     }
+}
 
-    while (start < contents.size()) {
-        const auto eol = contents.find('\n', start);
-        const auto line = _trim(contents.substr(start, eol - start));
-        const auto eoc = line.find(':');
-        const auto command = eoc == std::string::npos ? line : _trim(line.substr(0, eoc));
-        const auto data = eoc < line.size() ? _trim(line.substr(eoc + 1)) : std::string();
-        
-        if (line.empty()) {
-            // ignore empty lines
-        } else if (command == "clearSinks") {
-            Logger(Log)._logLineCore("Clearing Sinks");
-            clearSinks();
-        } else if (command == "setFormatDefault") {
-            setFormat(std::unique_ptr<DefaultFormatter>(new DefaultFormatter()));
-            Logger(Log)._logLineCore("Resetting format to default");
-        } else if (command == "setFormatDefaultGMT") {
-            setFormat(std::unique_ptr<DefaultFormatter>(new DefaultFormatter(DefaultFormatter::GMT)));
-            Logger(Log)._logLineCore("Resetting format to default GMT");
-        } else if (command == "addSinkStdErr") {
-            addSink(std::unique_ptr<StdErrSink>(new StdErrSink()));
-            Logger(Log)._logLineCore("Adding stderr sink");
-        } else if (command == "addSinkStdOut") {
-            addSink(std::unique_ptr<StdOutSink>(new StdOutSink()));
-            Logger(Log)._logLineCore("Adding stdout sink");
-        } else if (command == "addSink") {
-            if (!data.empty()) {
-                try {
-                    addSink(std::unique_ptr<FileSink>(new FileSink(data)));
-                    Logger(Log)._logLineCore("Adding sink to " + data);
-                } catch(const std::exception& exception) {
-                    Logger(Log)._logLineCore("Error adding sink to " + data 
-                                                + ": " + exception.what());
-                }
-            } else {
-                Logger(Log)._logLineCore("Failed to add sink: " + line);
-            }
-        } else if (command == "resetLevels") {
-            resetLevels(_fromString(data));
-            Logger(Log)._logLineCore("resetLevels to " + std::to_string(_fromString(data)));
-        } else if (command == "pad") {
-            setInserterSpacing(InserterPad);
-            Logger(Log)._logLineCore("Turned padding on");
-        } else if (command == "noPad") {
-            setInserterSpacing(InserterAsIs);
-            Logger(Log)._logLineCore("Turned padding off");
-        } else if (command == "setLevel") {
-            const auto equals = data.find('=');
-            const auto level = _fromString(data.substr(0, equals));
-            const auto pattern = equals < data.size() 
-                                    ? _trim(data.substr(equals+1)) 
-                                    : std::string();
+inline bool NetworkSink::_wait(int events, int milliseconds) {
+    // in short slices so the destructor is not held up by a dead collector
+    for (int waited = 0; waited < milliseconds; waited += 100) {
+        struct pollfd descriptor;
 
-            setLevel(level, pattern);
-            Logger(Log)._logLineCore("Set level #" + std::to_string(level) 
-                                  + " pattern = '" + pattern + "'");
-        } else {
-            Logger(Log)._logLineCore("Unknown command '" + command + "': " + line);
+        descriptor.fd = _socket;
+        descriptor.events = static_cast<short>(events);
+        descriptor.revents = 0;
+
+        const auto ready = ::poll(&descriptor, 1, std::min(100, milliseconds - waited));
+
+        if (ready > 0) {
+            return true;
+        }
+
+        if ((ready < 0 && EINTR != errno) || _stopping) {
+            return false;
         }
+    }
+
+    return false;
+}
+
+inline DefaultFormatter::DefaultFormatter(Location location, Precision precision)
+    :_location(location), _precision(precision) {}
+
+inline std::string DefaultFormatter::format(const std::string& line, size_t thread, const Logger& logger) {
+    std::string buffer;
 
-        start = eol < contents.size() ? eol + 1 : eol;
-    }
+    formatInto(buffer, line.data(), line.size(), thread, logger);
+    return buffer;
 }
 
-inline std::string Logger::_settingsContents(const std::string& newPath, int checkIntervalSeconds) {
-    static std::string path;
-    static std::string lastContents;
-    static Timestamp lastCheck;
-    static int interval = 120;
+inline void DefaultFormatter::formatInto(std::string& buffer, const char* line, size_t size, size_t thread, const Logger& logger) {
+    formatAt(buffer, line, size, thread, Logger::threadName(), logger, std::chrono::system_clock::now());
+}
 
-    Lock protection(_mutex(SettingsMutex));
-    const auto pathChanged = !newPath.empty() && newPath != path;
-    
-    if (!newPath.empty()) {
-        path = newPath;
-        interval = checkIntervalSeconds;
-        lastCheck = pathChanged ? Timestamp() : lastCheck;
+inline void DefaultFormatter::formatAt(std::string& buffer, const char* line, size_t size, size_t thread,
+                                       const std::string& threadName, const Logger& logger,
+                                       const Logger::Timestamp& when) const {
+    buffer.append(1, '[');
+    _appendDate(buffer, _location, _precision, when);
+    buffer.append("][", 2);
+
+    if (threadName.empty()) {
+        _appendDecimal(buffer, thread);
+    } else {
+        buffer.append(threadName);
     }
 
-    if (path.empty()) {
-        return ""; // no path to check
+    buffer.append("][", 2);
+    buffer.append(_levelText(logger.levelRequested));
+
+    if (logger.file) {
+        buffer.append("][", 2);
+        buffer.append(logger.file);
+        buffer.append(1, ':');
+        _appendDecimal(buffer, static_cast<uint64_t>(logger.line));
     }
 
-    const auto now = std::chrono::system_clock::now();
-    const auto duration = now - lastCheck;
-    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
-    const auto timeToCheck = seconds >= interval;
+    if (logger.function) {
+        buffer.append("][", 2);
+        buffer.append(logger.function);
+    }
 
-    if (!timeToCheck) {
-        return "";
+    if (logger.condition) {
+        buffer.append("][", 2);
+        buffer.append(logger.condition);
     }
 
-    lastCheck = now;
+    buffer.append("] ", 2);
 
-    const auto contents = _readFile(path);
+    const auto context = Context::current();
 
-    if (contents.empty() || contents == lastContents) {
-        return ""; // doesn't exist, can't read it, or hasn't changed
+    if (nullptr != context) {
+        buffer.append(context->text());
     }
 
-    lastContents = contents;
-    return contents;
-}
+    buffer.append(line, size);
 
-inline std::string Logger::_readFile(const std::string& path) {
-    std::string buffer;
+    auto fields = logger.fields();
+    Fields::Field field;
+    auto separate = size > 0;
 
-    const auto file = ::fopen(path.c_str(), "r");
+    while (fields.next(field)) {
+        if (separate) {
+            buffer.append(1, ' ');
+        }
 
-    if (nullptr == file) {
-        return "";
+        buffer.append(field.key, field.keySize);
+        buffer.append(1, '=');
+        buffer.append(field.value, field.valueSize);
+        separate = true;
     }
 
-    ::fseek(file, 0, SEEK_END);
-    const size_t fileSize = static_cast<size_t>(::ftell(file));
-    ::rewind(file);
-    buffer.assign(fileSize, '\0');
-    const auto bytesRead = ::fread(&buffer[0], 1, fileSize, file);
-    ::fclose(file);
-    return bytesRead == fileSize ? buffer : std::string();
+    buffer.append(1, '\n');
 }
 
-inline Level Logger::_fromString(const std::string &level) {
-    if (level.empty()) {
-        return Error;
-    }
+inline std::string DefaultFormatter::format(const std::exception& exception) {
+    return std::string("Exception: ") + exception.what();
+}
 
-    switch(level[0]) {
-        case 'l':
-        case 'L':
-            return Log;
-        case 'E':
-        case 'e':
-            return Error;
-        case 'w':
-        case 'W':
-            return Warning;
-        case 'i':
-        case 'I':
-            return Info;
-        case 'd':
-        case 'D':
-            return Debug;
-        case 'v':
-        case 'V':
-            return Verbose;
-        case 't':
-        case 'T':
-            return Trace;
-        default:
-            return Error;
-        }
+inline std::string DefaultFormatter::date(Location location, Precision precision) {
+    std::string buffer;
+
+    _appendDate(buffer, location, precision, std::chrono::system_clock::now());
+    return buffer;
 }
 
-inline std::string Logger::_trim(const std::string &str) {
-    auto result = str;
+inline std::string DefaultFormatter::levelString(Level level) {
+    return _levelText(level);
+}
 
-    while (!result.empty() && std::isspace(result[0])) {
-        result.erase(0, 1);
+inline const char* DefaultFormatter::_levelText(Level level) {
+    switch(level) {
+        case Fatal:
+            return "FTL";
+        case Log:
+            return "LOG";
+        case Error:
+            return "ERR";
+        case Warning:
+            return "WRN";
+        case Info:
+            return "NFO";
+        case Debug:
+            return "DBG";
+        case Verbose:
+            return "VBS";
+        case Trace:
+            return "TRC";
+        default:
+            return "???";
     }
+}
 
-    while (!result.empty() && std::isspace(result[result.size() - 1])) {
-        result.erase(result.size() - 1);
-    }
+inline void DefaultFormatter::_appendDecimal(std::string& buffer, uint64_t value) {
+    char digits[Number::BufferSize];
 
-    return result;
+    buffer.append(digits, Number::write(digits, value));
 }
 
-inline bool Logger::_fileMatches(const std::string& file, const std::string& pattern) {
-    /*
-        Rules:
-        1. No files matches a pattern of "-"
-        2. Any file matches an empty pattern (including an empty file)
-        3. All positive patterns are ORed and all negative patterns are ANDed
+inline DefaultFormatter::SecondCache& DefaultFormatter::_secondCache(Location location) {
+    static thread_local SecondCache gmt;
+    static thread_local SecondCache local;
 
-        Example:
-        - "-" match nothing
-        - "" match everything
-        - "-bin/" match everything except files that contain "bin/"
-        - "src/;-src/include/" match everything that contains "src/" 
-                                unless it contains "src/include/"
-        - ".h;.cpp;-main.cpp;-test.cpp" match all files that have ".h" or ".cpp" in them
-                                            but don't match any that contain "main.cpp"
-                                                or "test.cpp"
+    return GMT == location ? gmt : local;
+}
+
+inline void DefaultFormatter::_appendDate(std::string& buffer, Location location, Precision precision,
+                                          const Logger::Timestamp& when) {
+    /*
+        Everything but the fraction of a second only changes once a second,
+        so each thread keeps the last second it formatted.
     */
-    size_t start = 0;
-    auto good = true;
+    const auto nowHiRes = when;
+    const auto nowSeconds = std::chrono::system_clock::to_time_t(nowHiRes);
+    const auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(nowHiRes.time_since_epoch());
+    auto& cache = _secondCache(location);
 
-    while (start < pattern.size()) {
-        const auto end = pattern.find(';', start);
-        const auto part = pattern.substr(start, end-start);
-        const auto negative = part.find('-') == 0;
-        const auto name = part.substr(negative ? 1 : 0);
-        const auto matches = file.find(name) != std::string::npos;
-        
-        if (matches) {
-            good = !negative;
-        }
-        
-        start = end < pattern.size() ? end + 1 : end;
-    }
+    if (!cache.valid || cache.second != nowSeconds) {
+        struct tm now;
 
-    return good;
-}
+        ::memset(&now, 0, sizeof(now));
 
-inline StreamSink::StreamSink(FILE* stream, const std::string& name, CloseAction action) 
-    :_name(name), _stream(stream), _close(action == AutoClose) {}
+        const auto result = GMT == location 
+                            ? ::gmtime_r(&nowSeconds, &now) 
+                            : ::localtime_r(&nowSeconds, &now);
 
-inline StreamSink::~StreamSink() {
-    if (_close && nullptr != _stream) {
-        if (::fclose(_stream) != 0) {
-            // too late
+        if (nullptr == result) {
+            throw RuntimeError("Unable to get time");
+        }
+
+        char before[32];
+        char after[32];
+        const auto beforeSize = ::strftime(before, sizeof(before), "%Y-%m-%d %H:%M:%S", &now);
+        const auto afterSize = ::strftime(after, sizeof(after), 
+                                          GMT == location ? " (%a)" : " %z (%a)", &now);
+
+        if (0 == beforeSize || 0 == afterSize) {
+            throw RuntimeError("Unable to format time");
         }
+
+        cache.before.assign(before, beforeSize);
+        cache.after.assign(after, afterSize);
+        cache.second = nowSeconds;
+        cache.valid = true;
     }
-}
 
-inline void StreamSink::log(const std::string&line) {
-    errno = 0;
-    const auto amount = ::fwrite(reinterpret_cast<const char *>(line.c_str()), 1, line.size(), _stream);
-    const auto error = errno;
+    const int digits = Nanoseconds == precision ? 9 : Microseconds == precision ? 6 : 3;
+    auto fraction = static_cast<uint64_t>(sinceEpoch.count() % 1000000000);
+    char fractionText[10];
 
-    if (::ferror(_stream)) {
-        throw std::system_error(
-            std::error_code(error, std::generic_category()),
-            "Failed to log to '" + _name + "': " + ::strerror(error)
-        );
+    for (int skip = 9; skip > digits; --skip) {
+        fraction /= 10;
     }
 
-    if (amount < line.size()) {
-        throw std::runtime_error("Incomplete write to " + _name);
+    for (int digit = digits - 1; digit >= 0; --digit) {
+        fractionText[digit] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
     }
+
+    buffer.append(cache.before);
+    buffer.append(1, '.');
+    buffer.append(fractionText, static_cast<size_t>(digits));
+    buffer.append(cache.after);
 }
 
-inline StdErrSink::StdErrSink()
-    :StreamSink(stderr, "stderr", StreamSink::DoNotClose) {}
+inline StructuredFormatter::StructuredFormatter(Style style, DefaultFormatter::Precision precision)
+    :_style(style), _precision(precision) {}
 
-inline StdOutSink::StdOutSink()
-    :StreamSink(stdout, "stdout", StreamSink::DoNotClose) {}
+inline std::string StructuredFormatter::format(const std::string& line, size_t thread, const Logger& logger) {
+    std::string buffer;
 
-inline FileSink::FileSink(const std::string& path)
-    :StreamSink(_open(path), path, StreamSink::AutoClose) {}
+    formatInto(buffer, line.data(), line.size(), thread, logger);
+    return buffer;
+}
 
-inline FILE* FileSink::_open(const std::string& path) {
-    auto opened = ::fopen(path.c_str(), "a");
+inline std::string StructuredFormatter::format(const std::exception& exception) {
+    return std::string("Exception: ") + exception.what();
+}
 
-    if (nullptr == opened) {
-        const auto error = errno;
+inline void StructuredFormatter::formatInto(std::string& buffer, const char* line, size_t size, size_t thread,
+                                            const Logger& logger) {
+    char number[Number::BufferSize];
+    const auto& threadName = Logger::threadName();
+    const auto level = levelName(logger.levelRequested);
 
-        throw std::system_error(
-            std::error_code(error, std::generic_category()),
-            "Failed to open log '" + path + "': " + ::strerror(error)
-        );
+    if (Json == _style) {
+        buffer.append(1, '{');
     }
 
-    return opened;
-}
+    _key(buffer, "time", 4, true);
+    _time(buffer, std::chrono::system_clock::now());
+    _key(buffer, "level", 5, false);
+    _string(buffer, level, ::strlen(level));
+    _key(buffer, "thread", 6, false);
 
-inline void SyslogSink::log(const std::string& line) {
-    syslog(LOG_NOTICE, "%s", line.c_str());
-}
+    if (threadName.empty()) {
+        _number(buffer, number, Number::write(number, thread));
+    } else {
+        _string(buffer, threadName.data(), threadName.size());
+    }
 
-inline DefaultFormatter::DefaultFormatter(Location location)
-    :_location(location) {}
+    if (logger.file) {
+        _key(buffer, "file", 4, false);
+        _string(buffer, logger.file, ::strlen(logger.file));
+        _key(buffer, "line", 4, false);
+        _number(buffer, number, Number::write(number, logger.line));
+    }
 
-inline std::string DefaultFormatter::format(const std::string& line, size_t thread, const Logger& logger) {
-    return "[" + date(_location)
-        + "][" + std::to_string(thread)
-        + "][" + levelString(logger.levelRequested)
-        + (logger.file ? ("][" + std::string(logger.file) + ":" + std::to_string(logger.line)) : std::string())
-        + (logger.function ? ("][" + std::string(logger.function)) : std::string())
-        + (logger.condition ? ("][" + std::string(logger.condition)) : std::string())
-        + "] " + line + "\n";
-}
+    if (logger.function) {
+        _key(buffer, "function", 8, false);
+        _string(buffer, logger.function, ::strlen(logger.function));
+    }
 
-inline std::string DefaultFormatter::format(const std::exception& exception) {
-    return std::string("Exception: ") + exception.what();
-}
+    if (logger.condition) {
+        _key(buffer, "condition", 9, false);
+        _string(buffer, logger.condition, ::strlen(logger.condition));
+    }
 
-inline std::string DefaultFormatter::date(Location location) {
-    const auto nowHiRes = std::chrono::system_clock::now();
-    const auto nowSeconds = std::chrono::system_clock::to_time_t(nowHiRes);
-    const auto ms = _ms_str(nowHiRes);
-    struct tm now;
-    std::string buffer;
+    const auto context = Context::current();
 
-    ::memset(&now, 0, sizeof(now));
+    if (nullptr != context) {
+        if (Json == _style) {
+            buffer.append(1, ',');
+            buffer.append(context->json(), 0, context->json().size() - 1); // without the last comma
+        } else {
+            buffer.append(context->logfmt());
+        }
+    }
+
+    _key(buffer, "message", 7, false);
+    _string(buffer, line, size);
 
-    const auto result = GMT == location 
-                        ? ::gmtime_r(&nowSeconds, &now) 
-                        : ::localtime_r(&nowSeconds, &now);
+    auto fields = logger.fields();
+    Fields::Field field;
 
-    if (nullptr == result) {
-        throw RuntimeError("Unable to get time");
+    while (fields.next(field)) {
+        appendField(buffer, field, false);
     }
 
-    buffer.assign(35, '\0');
-    const auto size = ::strftime(_writable(buffer), buffer.length(), 
-                                GMT == location
-                                    ? "%Y-%m-%d %H:%M:%S.MS (%a)"
-                                    : "%Y-%m-%d %H:%M:%S.MS %z (%a)",
-                                &now);
-                                
-    if (0 == size) {
-        throw RuntimeError("Unable to format time");
+    if (Json == _style) {
+        buffer.append(1, '}');
     }
 
-    buffer.erase(size);
-    return _replace(buffer, ".MS", "." + ms);
+    buffer.append(1, '\n');
 }
 
-inline std::string DefaultFormatter::levelString(Level level) {
+inline void StructuredFormatter::appendField(std::string& buffer, const Fields::Field& field, bool first) const {
+    _key(buffer, field.key, field.keySize, first);
+
+    if (KeyValue::String == field.kind) {
+        _string(buffer, field.value, field.valueSize);
+    } else if (KeyValue::Numeric == field.kind) {
+        _number(buffer, field.value, field.valueSize);
+    } else {
+        buffer.append(field.value, field.valueSize);
+    }
+}
+
+inline const char* StructuredFormatter::levelName(Level level) {
     switch(level) {
         case Fatal:
-            return "FTL";
+            return "fatal";
         case Log:
-            return "LOG";
+            return "log";
         case Error:
-            return "ERR";
+            return "error";
         case Warning:
-            return "WRN";
+            return "warning";
         case Info:
-            return "NFO";
+            return "info";
         case Debug:
-            return "DBG";
+            return "debug";
         case Verbose:
-            return "VBS";
+            return "verbose";
         case Trace:
-            return "TRC";
+            return "trace";
         default:
-            return "???";
+            return "unknown";
+    }
+}
+
+inline void StructuredFormatter::_key(std::string& buffer, const char* key, size_t size, bool first) const {
+    if (Json == _style) {
+        if (!first) {
+            buffer.append(1, ',');
+        }
+
+        buffer.append(1, '"');
+        _escapeJson(buffer, key, size);
+        buffer.append("\":", 2);
+        return;
+    }
+
+    if (!first) {
+        buffer.append(1, ' ');
+    }
+
+    for (size_t index = 0; index < size; ++index) { // logfmt keys cannot be quoted, so separators become _
+        const auto character = key[index];
+
+        buffer.append(1, character <= ' ' || '=' == character || '"' == character ? '_' : character);
+    }
+
+    buffer.append(1, '=');
+}
+
+inline void StructuredFormatter::_string(std::string& buffer, const char* value, size_t size) const {
+    if (Logfmt == _style && _isBareLogfmt(value, size)) {
+        buffer.append(value, size);
+        return;
     }
+
+    buffer.append(1, '"');
+    _escapeJson(buffer, value, size); // logfmt quotes the same way
+    buffer.append(1, '"');
 }
 
-inline char* DefaultFormatter::_writable(std::string& str) {
-    return str.empty() ? nullptr : &str[0];
+inline void StructuredFormatter::_number(std::string& buffer, const char* value, size_t size) const {
+    if (Json == _style && !_isJsonNumber(value, size)) {
+        _string(buffer, value, size); // nan and inf are not JSON numbers
+        return;
+    }
+
+    buffer.append(value, size);
 }
 
-inline std::string DefaultFormatter::_ms_str(const std::chrono::system_clock::time_point& time) {
-    const auto now = time.time_since_epoch();
-    const auto now_in_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now);
-    auto ms_str = std::to_string((now_in_ms % 1000).count());
+inline void StructuredFormatter::_time(std::string& buffer, const Logger::Timestamp& when) const {
+    static thread_local SecondCache cache;
+    const auto seconds = std::chrono::system_clock::to_time_t(when);
+    const auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch());
+
+    if (!cache.valid || cache.second != seconds) {
+        struct tm now;
+        char text[32];
 
-    while (ms_str.size() < 3) {
-        ms_str = '0' + ms_str;
+        ::memset(&now, 0, sizeof(now));
+
+        if (nullptr == ::gmtime_r(&seconds, &now)) {
+            throw DefaultFormatter::RuntimeError("Unable to get time");
+        }
+
+        const auto textSize = ::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &now);
+
+        if (0 == textSize) {
+            throw DefaultFormatter::RuntimeError("Unable to format time");
+        }
+
+        cache.text.assign(text, textSize);
+        cache.second = seconds;
+        cache.valid = true;
     }
-    
-    return ms_str;
+
+    const int digits = DefaultFormatter::Nanoseconds == _precision ? 9
+                     : DefaultFormatter::Microseconds == _precision ? 6 : 3;
+    auto fraction = static_cast<uint64_t>(sinceEpoch.count() % 1000000000);
+    char fractionText[10];
+
+    for (int skip = 9; skip > digits; --skip) {
+        fraction /= 10;
+    }
+
+    for (int digit = digits - 1; digit >= 0; --digit) {
+        fractionText[digit] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+    }
+
+    if (Json == _style) {
+        buffer.append(1, '"');
+    }
+
+    buffer.append(cache.text);
+    buffer.append(1, '.');
+    buffer.append(fractionText, static_cast<size_t>(digits));
+    buffer.append(1, 'Z');
+
+    if (Json == _style) {
+        buffer.append(1, '"');
+    }
+}
+
+inline void StructuredFormatter::_escapeJson(std::string& buffer, const char* value, size_t size) {
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0;
+
+    // runs of characters that need no escaping are copied at once
+    for (size_t index = 0; index < size; ++index) {
+        const auto character = static_cast<unsigned char>(value[index]);
+
+        if (character >= 0x20 && '"' != character && '\\' != character) {
+            continue;
+        }
+
+        buffer.append(value + start, index - start);
+        start = index + 1;
+
+        switch (character) {
+            case '"':
+                buffer.append("\\\"", 2);
+                break;
+            case '\\':
+                buffer.append("\\\\", 2);
+                break;
+            case '\n':
+                buffer.append("\\n", 2);
+                break;
+            case '\r':
+                buffer.append("\\r", 2);
+                break;
+            case '\t':
+                buffer.append("\\t", 2);
+                break;
+            default: {
+                const char escaped[] = {'\\', 'u', '0', '0', hex[character >> 4], hex[character & 0xf]};
+
+                buffer.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+
+    buffer.append(value + start, size - start);
+}
+
+inline bool StructuredFormatter::_isJsonNumber(const char* value, size_t size) {
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?, anything else (nan, inf) is quoted
+    size_t at = size > 0 && '-' == value[0] ? 1U : 0U;
+    const auto digits = [value, size, &at]() {
+        const auto first = at;
+
+        while (at < size && value[at] >= '0' && value[at] <= '9') {
+            ++at;
+        }
+
+        return at - first;
+    };
+    const auto leadingZero = at < size && '0' == value[at];
+    const auto integer = digits();
+
+    if (0 == integer || (leadingZero && integer > 1)) {
+        return false;
+    }
+
+    if (at < size && '.' == value[at]) {
+        ++at;
+
+        if (0 == digits()) {
+            return false;
+        }
+    }
+
+    if (at < size && ('e' == value[at] || 'E' == value[at])) {
+        ++at;
+        at += at < size && ('+' == value[at] || '-' == value[at]) ? 1 : 0;
+
+        if (0 == digits()) {
+            return false;
+        }
+    }
+
+    return at == size;
 }
 
-inline std::string& DefaultFormatter::_replace(std::string& str, const std::string& search, const std::string& replace) {
-    size_t pos = 0;
+inline bool StructuredFormatter::_isBareLogfmt(const char* value, size_t size) {
+    if (0 == size) {
+        return false;
+    }
 
-    while ((pos = str.find(search, pos)) != std::string::npos) {
-        str.replace(pos, search.length(), replace);
-        pos += replace.length();
+    for (size_t index = 0; index < size; ++index) {
+        const auto character = static_cast<unsigned char>(value[index]);
+
+        if (character <= ' ' || '=' == character || '"' == character || '\\' == character) {
+            return false;
+        }
     }
 
-    return str;
+    return true;
 }
 
 }
 
-#ifndef DISABLE_YALO_TRACE
+#if !defined(DISABLE_YALO_TRACE) && YALO_MIN_LEVEL >= 7
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wkeyword-macro"
-#define if(expression) if(yalo::Logger(yalo::Trace, __FILE__, __LINE__, __func__).logExpressionBool("if", #expression, expression))
-#define while(expression) while(yalo::Logger(yalo::Trace, __FILE__, __LINE__, __func__).logExpressionBool("while", #expression, expression))
-#define switch(expression) switch(yalo::Logger(yalo::Trace, __FILE__, __LINE__, __func__).logExpression("switch", #expression, expression))
+#define YALO_TRACESITE(flow, expression) \
+    [](const char* yaloFunction) -> const yalo::TraceSite& { \
+        static const yalo::TraceSite yaloTraceSite(flow, expression, __FILE__, __LINE__, yaloFunction); \
+        return yaloTraceSite; \
+    }(__func__)
+#define if(expression) if(YALO_TRACESITE("if", #expression).evaluated(static_cast<bool>(expression)))
+#define while(expression) while(YALO_TRACESITE("while", #expression).evaluated(static_cast<bool>(expression)))
+#define switch(expression) switch(YALO_TRACESITE("switch", #expression).evaluated(expression))
 #pragma GCC diagnostic pop
 #endif
\ No newline at end of file